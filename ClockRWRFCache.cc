@@ -1,181 +1,977 @@
 #include "ClockRWRFCache.h"
 #include <iostream> 
 #include <algorithm>
+#include <chrono>
+#include <numeric>
+#include <string_view>
+
+static uint64_t systemClockMs() {
+    return std::chrono::duration_cast<std::chrono::milliseconds>(
+        std::chrono::system_clock::now().time_since_epoch()).count();
+}
 
 ClockCache::ClockCache(PMmanager* pm, size_t dramSize, size_t nvmSize) 
-    : pm(pm), dramCapacity(dramSize), nvmCapacity(nvmSize), nvm_list(pm) {}
+    : pm(pm), nvm_list(pm), dramCapacity(dramSize), nvmCapacity(nvmSize), nvmShadowBudget(0),
+      maxEvictionScan(kDefaultMaxEvictionScan),
+      dramLowWatermark(dramSize), dramHighWatermark(dramSize), nvmLowWatermark(nvmSize), nvmHighWatermark(nvmSize),
+      shadowLowWatermark(0), shadowHighWatermark(0),
+      lowWatermarkRatio(1.0), highWatermarkRatio(1.0),
+      dramEvictions(0), nvmEvictions(0), backgroundDramEvictions(0), backgroundNvmEvictions(0),
+      demoteEvictions(false), demoteMinStatus(DramNode::Initial), demotions(0), warmRestart(false),
+      loadTier(LoadTier::Dram), clock(systemClockMs), expirations(0),
+      admissionRejectToNvm(false), admissionRejections(0),
+      minDramCapacity(dramSize), maxDramCapacity(dramSize), adaptStep(0), splitAdaptations(0),
+      nvmCompactionRatio(0), nvmCompactions(0), compacting(false), epoch(nullptr) {}
+
+ClockCache::~ClockCache(){
+    // 解構時已沒有讀者，直接釋放所有等待回收的節點
+    reclaimRetired(true);
+    // 暖啟動時NVM節點留給下一次recover()，交給pool而不是由nvm_list釋放
+    if (warmRestart) nvm_list.detach();
+}
+
+size_t ClockCache::recover() {
+    enableWarmRestart();
+    size_t adopted = 0;
+    NvmCircularLinkedList::recoverRecords(pm, [this, &adopted](NvmRecord* record) {
+        if (adoptNvmRecord(record)) adopted++;
+    });
+    return adopted;
+}
+
+bool ClockCache::adoptNvmRecord(NvmRecord* record) {
+    uint64_t hash = hashKey(record->keyView());
+    uintptr_t existing = keyIndex.find(record->keyView(), hash);
+    if (existing != 0) {
+        // 前一次crash在新record寫入後、舊record標記前時，同一個key會有兩個record
+        NvmNode* other = KeyIndex::nvmNode(existing);
+        if (other == nullptr || other->record->version > record->version) {
+            nvm_list.freeRecord(record);
+            return false;
+        }
+        eraseNvmNode(other);
+    }
+    // 停機期間已經過期的record不再放入
+    if (nvm_list.usedBytes() + nvm_list.appendBytes(record->size) > nvmCapacity ||
+        !nvmShadowFits(record->keyLength, nullptr) || isExpired(record->expiresAt)) {
+        nvm_list.freeRecord(record);
+        return false;
+    }
+    NvmNode* node = nvm_list.adoptRecord(record);
+    indexNode(node, hash);
+    scheduleExpiry(node);
+    return true;
+}
+
+void ClockCache::enableOptimisticReads(EpochManager* epoch, size_t indexCapacity) {
+    this->epoch = epoch;
+    readIndex.reset(new ConcurrentReadIndex(indexCapacity));
+    readBuffer.reset(new ReadBuffer());
+}
+
+CacheHandle::CacheHandle(CacheHandle&& other) noexcept
+    : cache(other.cache), node(other.node), isNvm(other.isNvm), mutex(other.mutex) {
+    other.cache = nullptr;
+    other.node = nullptr;
+}
+
+CacheHandle& CacheHandle::operator=(CacheHandle&& other) noexcept {
+    if (this != &other) {
+        release();
+        cache = other.cache;
+        node = other.node;
+        isNvm = other.isNvm;
+        mutex = other.mutex;
+        other.cache = nullptr;
+        other.node = nullptr;
+    }
+    return *this;
+}
+
+std::string_view CacheHandle::value() const {
+    if (node == nullptr) return std::string_view();
+    if (isNvm) return static_cast<NvmNode*>(node)->dataView();
+    return static_cast<DramNode*>(node)->dataView();
+}
+
+void CacheHandle::release() {
+    if (node == nullptr) return;
+    if (mutex) {
+        std::lock_guard<std::mutex> lock(*mutex);
+        cache->release(this);
+    } else {
+        cache->release(this);
+    }
+    cache = nullptr;
+    node = nullptr;
+}
+
+uint64_t ClockCache::hashKey(std::string_view key) {
+    return StringHash()(key);
+}
+
+static uintptr_t tagNode(DramNode* node) {
+    return reinterpret_cast<uintptr_t>(node);
+}
+
+static uintptr_t tagNode(NvmNode* node) {
+    return reinterpret_cast<uintptr_t>(node) | ConcurrentReadIndex::kNvmTag;
+}
+
+// 節點搬到另一個tier或重新配置時，把過期時間和timer交給新節點，舊節點刪除時就不會取消timer
+template <typename From, typename To>
+static void transferExpiry(From* from, To* to) {
+    to->expiresAt = from->expiresAt;
+    to->timer = from->timer;
+    from->timer = nullptr;
+    if (to->timer != nullptr) to->timer->node = tagNode(to);
+}
+
+template <typename Node>
+void ClockCache::scheduleExpiry(Node* node) {
+    if (node->expiresAt == 0) return;
+    if (!timerWheel) timerWheel.reset(new TimingWheel(kTimerTickMs, clock()));
+    node->timer = timerWheel->schedule(node->expiresAt, tagNode(node));
+}
+
+template <typename Node>
+void ClockCache::cancelExpiry(Node* node) {
+    if (node->timer == nullptr) return;
+    timerWheel->cancel(node->timer);
+    node->timer = nullptr;
+}
+
+size_t ClockCache::expireEntries(size_t maxEntries) {
+    if (!timerWheel) return 0;
+    return timerWheel->advance(clock(), maxEntries, [this](TimerEntry* entry) { return expireNode(entry); });
+}
+
+bool ClockCache::expireNode(TimerEntry* entry) {
+    // entry由timerWheel釋放，刪除節點前先斷開，erase時才不會再取消一次
+    if (DramNode* node = KeyIndex::dramNode(entry->node)) {
+        if (node->pins != 0) return false;
+        node->timer = nullptr;
+        eraseDramNode(node);
+    } else {
+        NvmNode* nvmNode = KeyIndex::nvmNode(entry->node);
+        if (nvmNode->pins != 0) return false;
+        nvmNode->timer = nullptr;
+        eraseNvmNode(nvmNode);
+    }
+    expirations++;
+    return true;
+}
+
+DramNode* ClockCache::findDram(std::string_view key) const {
+    return KeyIndex::dramNode(keyIndex.find(key, hashKey(key)));
+}
+
+NvmNode* ClockCache::findNvm(std::string_view key) const {
+    return KeyIndex::nvmNode(keyIndex.find(key, hashKey(key)));
+}
+
+void ClockCache::indexNode(DramNode* node, uint64_t hash) {
+    node->hash = hash;
+    keyIndex.insert(node->keyView(), hash, tagNode(node));
+}
+
+void ClockCache::indexNode(NvmNode* node, uint64_t hash) {
+    node->hash = hash;
+    keyIndex.insert(node->keyView(), hash, tagNode(node));
+}
+
+void ClockCache::refreshSwapCandidate(DramNode* node) {
+    if (node->isSwapEligible()) {
+        if (node->swapIndex == DramNode::kNotSwapCandidate) {
+            node->swapIndex = swapCandidates.size();
+            swapCandidates.push_back(node);
+        }
+    } else {
+        removeSwapCandidate(node);
+    }
+}
+
+void ClockCache::removeSwapCandidate(DramNode* node) {
+    size_t index = node->swapIndex;
+    if (index == DramNode::kNotSwapCandidate) return;
+    // 和最後一個交換後移除，O(1)
+    DramNode* last = swapCandidates.back();
+    swapCandidates[index] = last;
+    last->swapIndex = index;
+    swapCandidates.pop_back();
+    node->swapIndex = DramNode::kNotSwapCandidate;
+}
+
+DramNode* ClockCache::takeSwapCandidate() {
+    while (!swapCandidates.empty()) {
+        DramNode* node = swapCandidates.back();
+        removeSwapCandidate(node);
+        // 集合外直接修改過的節點可能已經不符合條件
+        if (node->isSwapEligible()) return node;
+    }
+    return nullptr;
+}
+
+void ClockCache::eraseDramNode(DramNode* node) {
+    cancelExpiry(node);
+    removeSwapCandidate(node);
+    keyIndex.erase(node->keyView(), node->hash, tagNode(node));
+    if (!readIndex && node->pins == 0) {
+        dram_list.deleteNode(node);
+        return;
+    }
+    // 先從readIndex移除，之後進入的讀者就看不到這個節點
+    if (readIndex) readIndex->unpublish(node->hash, tagNode(node));
+    dram_list.unlinkNode(node);
+    retired.push_back({epoch ? epoch->currentEpoch() : 0, node, false});
+    if (retired.size() >= kReclaimThreshold) {
+        reclaimRetired(false);
+    }
+}
+
+void ClockCache::eraseNvmNode(NvmNode* node) {
+    cancelExpiry(node);
+    keyIndex.erase(node->keyView(), node->hash, tagNode(node));
+    if (!readIndex && node->pins == 0) {
+        nvm_list.deleteNode(node);
+    } else {
+        if (readIndex) readIndex->unpublish(node->hash, tagNode(node));
+        nvm_list.unlinkNode(node);
+        retired.push_back({epoch ? epoch->currentEpoch() : 0, node, true});
+        if (retired.size() >= kReclaimThreshold) {
+            reclaimRetired(false);
+        }
+    }
+    if (compactionNotifier && !compacting && nvm_list.needsCompaction(nvmCompactionRatio)) {
+        compactionNotifier();
+    }
+}
 
-//TODO
-ClockCache::~ClockCache(){}
+void ClockCache::enableLogStructuredNvm(size_t segmentSize, double compactionRatio, std::function<void()> notifier) {
+    nvm_list.enableLog(segmentSize);
+    nvmCompactionRatio = compactionRatio;
+    compactionNotifier = std::move(notifier);
+}
+
+void ClockCache::relocateNvmNode(NvmNode* node) {
+    NvmNode* copy = nvm_list.insertPayload(node->payload(), node->keyLength, node->dataLength, node->expiresAt);
+    copy->attributes = node->attributes;
+    transferExpiry(node, copy);
+    uint64_t hash = node->hash;
+    eraseNvmNode(node);
+    indexNode(copy, hash);
+}
 
-void ClockCache::put(const string& key, const string& value) {
-    size_t newNodeSize = key.size() + value.size() + sizeof(DramNode); // 计算新节点的大小
+size_t ClockCache::compactNvm(size_t maxSegments) {
+    size_t compacted = 0;
+    std::vector<NvmNode*> live;
+    compacting = true;
+    while (compacted < maxSegments) {
+        NvmSegment* segment = nvm_list.compactionCandidate(nvmCompactionRatio);
+        if (segment == nullptr) break;
+        // 先收集再搬移：最後一個record被釋放時segment本身也會被釋放
+        live.clear();
+        size_t liveBytes = segment->liveBytes;
+        size_t found = 0;
+        nvm_list.forEachRecord(segment, [this, &live, &found](NvmRecord* record) {
+            if (record->state != NvmRecord::Live) return;
+            NvmNode* node = findNvm(record->keyView());
+            if (node != nullptr && node->record == record && node->pins == 0) {
+                live.push_back(node);
+                found += node->size;
+            }
+        });
+        for (NvmNode* node : live) {
+            relocateNvmNode(node);
+        }
+        // 不在索引中或被pin住的record搬不走，這個segment會一直是候選，停止避免重複處理
+        if (found != liveBytes) break;
+        compacted++;
+        nvmCompactions++;
+    }
+    compacting = false;
+    return compacted;
+}
+
+bool ClockCache::reclaimNvmSpace() {
+    if (nvm_list.isLogStructured() && compactNvm(1) > 0) return true;
+    return evictNvmNode();
+}
+
+void ClockCache::reclaimRetired(bool force) {
+    if (retired.empty()) return;
+    uint64_t safeEpoch = (force || !epoch) ? UINT64_MAX : epoch->advanceAndGetSafeEpoch();
+    size_t kept = 0;
+    for (size_t i = 0; i < retired.size(); i++) {
+        unsigned int pins = retired[i].isNvm ? static_cast<NvmNode*>(retired[i].node)->pins
+                                             : static_cast<DramNode*>(retired[i].node)->pins;
+        if (retired[i].epoch < safeEpoch && (force || pins == 0)) {
+            if (retired[i].isNvm) {
+                nvm_list.freeNode(static_cast<NvmNode*>(retired[i].node));
+            } else {
+                dram_list.freeNode(static_cast<DramNode*>(retired[i].node));
+            }
+        } else {
+            retired[kept++] = retired[i];
+        }
+    }
+    retired.resize(kept);
+}
+
+bool ClockCache::getOptimistic(std::string_view key, string* value, bool* needDrain) {
+    if (!readIndex) return false;
+    uint64_t hash = hashKey(key);
+    EpochManager::Guard guard(epoch);
+    for (size_t i = 0; i < ConcurrentReadIndex::kProbeWindow; i++) {
+        uintptr_t tagged = readIndex->load(hash, i);
+        if (tagged == 0) continue;
+        if (tagged & ConcurrentReadIndex::kNvmTag) {
+            NvmNode* node = reinterpret_cast<NvmNode*>(tagged & ~ConcurrentReadIndex::kNvmTag);
+            if (key != node->keyView()) continue;
+            // 過期的節點交給加鎖的get()移除
+            if (isExpired(node->expiresAt)) return false;
+            value->assign(node->dataView());
+        } else {
+            DramNode* node = reinterpret_cast<DramNode*>(tagged);
+            if (key != node->keyView()) continue;
+            if (isExpired(node->expiresAt)) return false;
+            value->assign(node->dataView());
+        }
+        // 節點狀態留給drainReadBuffer()批次更新，命中時對節點是唯讀的
+        bool drain = readBuffer->record(tagged, hash);
+        if (needDrain) *needDrain = drain;
+        return true;
+    }
+    return false;
+}
+
+void ClockCache::drainReadBuffer() {
+    if (!readBuffer) return;
+    readBuffer->drain([this](uintptr_t tagged, uint64_t hash) {
+        // 仍在readIndex中的節點一定還沒被retire，已刪除的節點事件直接丟棄
+        if (!readIndex->contains(hash, tagged)) return;
+        recordAccess(hash);
+        if (tagged & ConcurrentReadIndex::kNvmTag) {
+            reinterpret_cast<NvmNode*>(tagged & ~ConcurrentReadIndex::kNvmTag)->recordRead();
+        } else {
+            DramNode* node = reinterpret_cast<DramNode*>(tagged);
+            node->recordRead();
+            refreshSwapCandidate(node);
+        }
+    });
+}
+
+bool ClockCache::put(std::string_view key, std::string_view value, uint64_t ttlMs) {
+    // 逐出前先套用累積的存取事件，讓clock看到最新的reference
+    drainReadBuffer();
+    // 順便移除一小批已經過期的節點，不需要另外的清理執行緒
+    expireEntries(kForegroundExpireBatch);
+    uint64_t expiresAt = ttlMs == 0 ? 0 : clock() + ttlMs;
+
+    // 只查一次索引就能知道key在DRAM、NVM或都不在
+    uint64_t hash = hashKey(key);
+    return putWithLookup(key, value, hash, keyIndex.find(key, hash), expiresAt);
+}
+
+bool ClockCache::putWithLookup(std::string_view key, std::string_view value, uint64_t hash, uintptr_t existing,
+                               uint64_t expiresAt) {
+    size_t newNodeSize = DramCircularLinkedList::nodeSize(key.size(), value.size()); // 计算新节点的大小
     if (newNodeSize > dramCapacity) {
         // 如果新节点本身就大于DRAM的总容量，无法插入
-        // TODO: 返回错误或记录日志
-        return; // 直接返回，不执行插入
+        return false;
     }
 
+    recordAccess(hash);
+    // 無鎖讀者看得到(已放入readIndex)或被pin住的節點不能原地覆寫，改為建立新節點
+    bool canOverwrite = existing != 0 && !(readIndex && readIndex->contains(hash, existing));
+
     // 1. 檢查DRAM是否有該key
-    auto dramIt = dram_cacheMap.find(key);
-    if (dramIt != dram_cacheMap.end()) {
-        // 獲取舊節點的狀態並將其刪除
-        auto oldNode = dramIt->second;
-        auto oldStatus = oldNode->attributes.status; // 假設使用 attributes.status 來存儲狀態
-        dram_list.deleteNode(oldNode);
-        dram_cacheMap.erase(dramIt);
-        //檢查空間
-        while (dram_list.currentSize + newNodeSize > dramCapacity) {
-            evictDramNode();
+    if (DramNode* oldNode = KeyIndex::dramNode(existing)) {
+        unsigned int oldStatus = oldNode->attributes.status;
+        unsigned int newStatus = oldStatus > 0 ? oldStatus - 1 : 0; // 確保狀態不會小於0
+
+        // 新value放得進原本的節點時直接覆寫，保留環中的位置與索引
+        if (canOverwrite && oldNode->pins == 0 && dram_list.overwriteData(oldNode, value)) {
+            oldNode->attributes.reference = 1;
+            oldNode->attributes.status = newStatus;
+            refreshSwapCandidate(oldNode);
+            cancelExpiry(oldNode);
+            oldNode->expiresAt = expiresAt;
+            scheduleExpiry(oldNode);
+            return true;
+        }
+
+        // 先清出空間(舊節點的bytes可以算進去)再刪除舊節點，清不出來時保留舊的value。
+        // 逐出期間pin住舊節點，不會被選為victim
+        oldNode->pins++;
+        while (dram_list.currentSize - oldNode->size + newNodeSize > dramCapacity) {
+            if (!evictDramNode()) {
+                oldNode->pins--;
+                return false;
+            }
         }
+        oldNode->pins--;
+        eraseDramNode(oldNode);
         // 插入新節點
-        dram_list.insertNode(key, value);
-        auto newNode = dram_list.head->prev; // 新節點是列表的最後一個節點
-        dram_cacheMap[key] = newNode;
+        DramNode* newNode = dram_list.insertNode(key, value);
+        indexNode(newNode, hash);
         newNode->attributes.reference = 1;
+        newNode->expiresAt = expiresAt;
+        scheduleExpiry(newNode);
 
         // 更新狀態
-        unsigned int newStatus = std::max(static_cast<unsigned int>(0), oldStatus - 1); // 確保狀態不會小於0
         newNode->attributes.status = newStatus; // 直接設置狀態
 
-        return;
+        notifyIfAboveWatermark();
+        return true;
     }
 
     // 2. 檢查NVM是否有該key
-    auto nvmIt = nvm_cacheMap.find(key);
-    if (nvmIt != nvm_cacheMap.end()) {
-        // 獲取舊節點的狀態並將其刪除
-        auto oldNode = nvmIt->second;
-        auto oldStatus = oldNode->attributes.status;
-        nvm_list.deleteNode(oldNode);
-        nvm_cacheMap.erase(nvmIt);
-        size_t newNvmNodeSize = key.size() + value.size() + sizeof(NvmNode);
-        while (nvm_list.currentSize + newNodeSize > nvmCapacity) {
-            evictNvmNode();
+    if (NvmNode* oldNode = KeyIndex::nvmNode(existing)) {
+        unsigned int oldStatus = oldNode->attributes.status;
+        // 寫入次數累積到Migration為止
+        const unsigned int maxStatus = static_cast<unsigned int>(NvmNode::Migration);
+        unsigned int newStatus = oldStatus < maxStatus ? oldStatus + 1 : maxStatus;
+
+        // 原地覆寫只需要一次memcpy與persist，不必重新配置NVM
+        if (canOverwrite && oldNode->pins == 0 && nvm_list.overwriteData(oldNode, value, expiresAt)) {
+            cancelExpiry(oldNode);
+            scheduleExpiry(oldNode);
+            oldNode->attributes.reference = 1;
+            oldNode->attributes.status = newStatus;
+            if (newStatus == 2 || newStatus == 3) {
+                requestMigration(oldNode);
+            }
+            return true;
         }
-        
+
+        // 和DRAM相同，先清出空間再刪除舊節點。pin住的舊節點不會被逐出或被compaction搬走
+        size_t newNvmNodeSize = NvmCircularLinkedList::nodeSize(key.size(), value.size());
+        oldNode->pins++;
+        while (nvm_list.usedBytes() - nvm_list.releasableBytes(oldNode) + nvm_list.appendBytes(newNvmNodeSize) >
+               nvmCapacity) {
+            if (!reclaimNvmSpace()) {
+                oldNode->pins--;
+                return false;
+            }
+        }
+        while (!nvmShadowFits(key.size(), oldNode)) {
+            if (!evictNvmNode()) {
+                oldNode->pins--;
+                return false;
+            }
+        }
+        oldNode->pins--;
+        eraseNvmNode(oldNode);
+
         // Insert Node 
-        nvm_list.insertNode(key, value);
-        auto newNode = nvm_list.head->prev; 
-        nvm_cacheMap[key] = newNode;
+        NvmNode* newNode = nvm_list.insertNode(key, value, expiresAt);
+        indexNode(newNode, hash);
         newNode->attributes.reference = 1;
+        scheduleExpiry(newNode);
         
 
         // 更新狀態
-        unsigned int newStatus = (oldStatus + 1);
         newNode->attributes.status = newStatus;
+        notifyIfAboveWatermark();
         if (newStatus == 2 || newStatus == 3) {
-            triggerSwapWithDRAM(newNode);
+            requestMigration(newNode);
         }
-        return;
+        return true;
     }
 
     // 3. 如果在两个cache中都没有找到key
-    // 首先检查DRAM缓存是否有足够的空间
+    recordGhostHit(hash);
+    // 首先检查DRAM缓存是否有足够的空间，全部被pin住时放弃插入
     while (dram_list.currentSize + newNodeSize > dramCapacity) {
-        evictDramNode();
+        DramNode* victim = selectDramVictim();
+        if (victim == nullptr) return false;
+        // 開啟准入過濾時，新key不比victim熱就不擠掉它(已經過期的victim一律逐出)
+        if (admissionSketch && !isExpired(victim->expiresAt) &&
+            admissionSketch->frequency(hash) <= admissionSketch->frequency(victim->hash)) {
+            admissionRejections++;
+            if (admissionRejectToNvm && insertIntoNvm(key, value, hash, expiresAt)) {
+                notifyIfAboveWatermark();
+                return true;
+            }
+            return false;
+        }
+        evictDramVictim(victim);
     }
     // 挪出空間後，插入新的Node
-    dram_list.insertNode(key, value);
-    auto newNode = dram_list.head->prev; // 新節點是列表的最後一個節點
+    DramNode* newNode = dram_list.insertNode(key, value);
     newNode->attributes.reference = 1;
-    dram_cacheMap[key] = newNode;
+    indexNode(newNode, hash);
+    newNode->expiresAt = expiresAt;
+    scheduleExpiry(newNode);
+    notifyIfAboveWatermark();
 
-    return;
+    return true;
 }
 
-bool ClockCache::get(const string& key, string* value) {
+bool ClockCache::touch(std::string_view key, DramNode** dramNode, NvmNode** nvmNode) {
+    *dramNode = nullptr;
+    *nvmNode = nullptr;
+    uint64_t hash = hashKey(key);
+    // 沒有命中的讀取也計入頻率，之後寫入時才能和victim比較
+    recordAccess(hash);
+    uintptr_t tagged = keyIndex.find(key, hash);
     // Check if the key is in DRAM memory
-    auto dramIt = dram_cacheMap.find(key);
-    if (dramIt != dram_cacheMap.end()) {
+    if (DramNode* node = KeyIndex::dramNode(tagged)) {
+        // 過期的節點當作沒有命中，直接移除
+        if (isExpired(node->expiresAt)) {
+            eraseDramNode(node);
+            expirations++;
+            return false;
+        }
         // Key found in DRAM memory
-        *value = dramIt->second->data;
-         // Update the node's reference bit to 1 to indicate it was recently accessed
-        dramIt->second->attributes.reference = 1;
-        
-        switch(dramIt->second->attributes.status) {
-            case DramNode::Initial:
-                dramIt->second->setStatus(DramNode::Once_read);
-                break;
-            case DramNode::Once_read:
-                dramIt->second->setStatus(DramNode::Twice_read);
-                break;
-            case DramNode::Twice_read:
-                dramIt->second->setStatus(DramNode::Be_Migration);
-                // Optionally trigger a migration process if the status reaches a certain point
-                break;
+        // Set the reference bit and advance Initial -> Once_read -> Twice_read -> Be_Migration
+        // Optionally trigger a migration process if the status reaches a certain point
+        node->recordRead();
+        refreshSwapCandidate(node);
+        if (readIndex) {
+            readIndex->publish(hash, tagged);
         }
+        *dramNode = node;
         return true;
     }
 
      // Check if the key is in NVM
-    auto nvmIt = nvm_cacheMap.find(key);
-    if (nvmIt != nvm_cacheMap.end()) {
+    if (NvmNode* node = KeyIndex::nvmNode(tagged)) {
+        if (isExpired(node->expiresAt)) {
+            eraseNvmNode(node);
+            expirations++;
+            return false;
+        }
         // Key found in NVM
-        *value = nvmIt->second->data;
-
         // Update the twiceRead bit. Only update status if twiceRead is 1.
-        if (nvmIt->second->attributes.twiceRead == 1) {
-            // Update status 
-            switch (nvmIt->second->getStatus()) {
-                case NvmNode::Pre_Migration:
-                    nvmIt->second->setStatus(NvmNode::Be_Written);
-                    break;
-                case NvmNode::Be_Written:
-                    nvmIt->second->setStatus(NvmNode::Initial);
-                    break;
-            }
-            nvmIt->second->attributes.twiceRead = 0;
-        } else {
-            nvmIt->second->attributes.twiceRead = 1;
+        node->recordRead();
+        if (readIndex) {
+            readIndex->publish(hash, tagged);
         }
-
+        *nvmNode = node;
         return true;
     }
-    // Key is not in DRAM or NVM
-    // TODO: 提供函式讓外部資料寫入NVM cache(read 使用)
+    // Key is not in DRAM or NVM，由getOrLoad()向來源載入
+    recordGhostHit(hash);
     return false;
 }
 
+bool ClockCache::get(std::string_view key, string* value) {
+    DramNode* dramNode;
+    NvmNode* nvmNode;
+    if (!touch(key, &dramNode, &nvmNode)) {
+        return false;
+    }
+    value->assign(dramNode ? dramNode->dataView() : nvmNode->dataView());
+    return true;
+}
+
+bool ClockCache::getOrLoad(std::string_view key, string* value, const Loader& loader) {
+    if (get(key, value)) return true;
+    if (!loader(key, value)) return false;
+    insertLoaded(key, *value);
+    return true;
+}
+
+bool ClockCache::insertLoaded(std::string_view key, std::string_view value) {
+    uint64_t hash = hashKey(key);
+    // 呼叫者在load期間沒有持有鎖，這段時間put()寫入的值比來源的新
+    if (keyIndex.find(key, hash) != 0) return false;
+    if (loadTier == LoadTier::Dram) {
+        put(key, value);
+        return keyIndex.find(key, hash) != 0;
+    }
+
+    drainReadBuffer();
+    if (!insertIntoNvm(key, value, hash, 0)) return false;
+    notifyIfAboveWatermark();
+    return true;
+}
+
+bool ClockCache::insertIntoNvm(std::string_view key, std::string_view value, uint64_t hash, uint64_t expiresAt) {
+    size_t newNodeSize = NvmCircularLinkedList::nodeSize(key.size(), value.size());
+    if (newNodeSize > nvmCapacity) return false;
+    while (nvm_list.usedBytes() + nvm_list.appendBytes(newNodeSize) > nvmCapacity) {
+        if (!reclaimNvmSpace()) return false;
+    }
+    while (!nvmShadowFits(key.size(), nullptr)) {
+        if (!evictNvmNode()) return false;
+    }
+    NvmNode* newNode = nvm_list.insertNode(key, value, expiresAt);
+    // 和降級的節點一樣給一輪clock的保護
+    newNode->attributes.reference = 1;
+    indexNode(newNode, hash);
+    scheduleExpiry(newNode);
+    return true;
+}
+
+void ClockCache::enableAdmissionFilter(size_t expectedEntries, bool rejectToNvm) {
+    admissionSketch.reset(new FrequencySketch(expectedEntries));
+    admissionRejectToNvm = rejectToNvm;
+}
+
+CacheHandle ClockCache::lookup(std::string_view key) {
+    CacheHandle handle;
+    DramNode* dramNode;
+    NvmNode* nvmNode;
+    if (!touch(key, &dramNode, &nvmNode)) {
+        return handle;
+    }
+    handle.cache = this;
+    if (dramNode) {
+        dramNode->pins++;
+        // 被pin住的節點不能當交換對象
+        removeSwapCandidate(dramNode);
+        handle.node = dramNode;
+    } else {
+        nvmNode->pins++;
+        handle.node = nvmNode;
+        handle.isNvm = true;
+    }
+    return handle;
+}
+
+size_t ClockCache::multiGet(const std::vector<std::string_view>& keys, std::vector<string>* values,
+                            std::vector<bool>* found) {
+    size_t count = keys.size();
+    values->resize(count);
+    found->assign(count, false);
+
+    // 1. 先算好全部的hash，並預取每個key在索引中的控制byte與slot
+    std::vector<uint64_t> hashes(count);
+    for (size_t i = 0; i < count; i++) {
+        hashes[i] = hashKey(keys[i]);
+        keyIndex.prefetch(hashes[i]);
+    }
+
+    // 2. 查詢索引：先對整批探測slot並預取指紋相符的節點，再逐一比對key
+    for (size_t i = 0; i < count; i++) {
+        keyIndex.prefetchNodes(hashes[i]);
+    }
+    std::vector<DramNode*> dramNodes(count, nullptr);
+    std::vector<NvmNode*> nvmNodes(count, nullptr);
+    for (size_t i = 0; i < count; i++) {
+        uintptr_t tagged = keyIndex.find(keys[i], hashes[i]);
+        dramNodes[i] = KeyIndex::dramNode(tagged);
+        nvmNodes[i] = KeyIndex::nvmNode(tagged);
+    }
+
+    // 3. 複製value，同時預取後面幾個節點的資料。過期檢查也在這裡，讀expiresAt時節點標頭已經在cache中
+    const size_t kPrefetchDistance = 4;
+    size_t hits = 0;
+    for (size_t i = 0; i < count; i++) {
+        size_t ahead = i + kPrefetchDistance;
+        if (ahead < count) {
+            if (dramNodes[ahead]) __builtin_prefetch(dramNodes[ahead]->data);
+            else if (nvmNodes[ahead]) __builtin_prefetch(nvmNodes[ahead]->data);
+        }
+        // 過期的節點當作沒有命中。批次中重複的key指向同一個節點，刪除前一併清掉
+        if (dramNodes[i] && isExpired(dramNodes[i]->expiresAt)) {
+            DramNode* node = dramNodes[i];
+            std::replace(dramNodes.begin() + i, dramNodes.end(), node, static_cast<DramNode*>(nullptr));
+            eraseDramNode(node);
+            expirations++;
+        } else if (nvmNodes[i] && isExpired(nvmNodes[i]->expiresAt)) {
+            NvmNode* node = nvmNodes[i];
+            std::replace(nvmNodes.begin() + i, nvmNodes.end(), node, static_cast<NvmNode*>(nullptr));
+            eraseNvmNode(node);
+            expirations++;
+        }
+        if (dramNodes[i]) {
+            (*values)[i].assign(dramNodes[i]->dataView());
+        } else if (nvmNodes[i]) {
+            (*values)[i].assign(nvmNodes[i]->dataView());
+        } else {
+            continue;
+        }
+        (*found)[i] = true;
+        hits++;
+    }
+
+    // 4. 最後一次套用狀態更新，和touch()一樣每個key不論是否命中都計入准入頻率，沒有命中的key檢查ghost list
+    for (size_t i = 0; i < count; i++) {
+        recordAccess(hashes[i]);
+        if (dramNodes[i]) {
+            dramNodes[i]->recordRead();
+            refreshSwapCandidate(dramNodes[i]);
+            if (readIndex) readIndex->publish(hashes[i], tagNode(dramNodes[i]));
+        } else if (nvmNodes[i]) {
+            nvmNodes[i]->recordRead();
+            if (readIndex) readIndex->publish(hashes[i], tagNode(nvmNodes[i]));
+        } else {
+            recordGhostHit(hashes[i]);
+        }
+    }
+    return hits;
+}
+
+size_t ClockCache::multiPut(const std::vector<std::string_view>& keys, const std::vector<std::string_view>& values) {
+    if (keys.size() != values.size()) return 0;
+    size_t count = keys.size();
+    drainReadBuffer();
+    expireEntries(kForegroundExpireBatch);
+
+    // 每個key只算一次hash，並先預取索引
+    std::vector<uint64_t> hashes(count);
+    for (size_t i = 0; i < count; i++) {
+        hashes[i] = hashKey(keys[i]);
+        keyIndex.prefetch(hashes[i]);
+    }
+
+    // 重複的key只寫入最後一個value：依hash排序後，同一個hash裡key相同的較早項目跳過
+    std::vector<size_t> order(count);
+    std::iota(order.begin(), order.end(), 0);
+    std::sort(order.begin(), order.end(), [&hashes](size_t a, size_t b) {
+        return hashes[a] != hashes[b] ? hashes[a] < hashes[b] : a < b;
+    });
+    std::vector<bool> skip(count, false);
+    for (size_t begin = 0, end; begin < count; begin = end) {
+        for (end = begin + 1; end < count && hashes[order[end]] == hashes[order[begin]]; end++) {}
+        for (size_t j = begin; j < end; j++) {
+            for (size_t k = j + 1; k < end && !skip[order[j]]; k++) {
+                if (keys[order[j]] == keys[order[k]]) skip[order[j]] = true;
+            }
+        }
+    }
+
+    // 估算整批寫入需要的新空間，查詢結果留給之後的寫入使用：新key進DRAM，已存在的key只計入變大的部分
+    std::vector<uintptr_t> existing(count, 0);
+    size_t dramNeeded = 0;
+    size_t nvmNeeded = 0;
+    for (size_t i = 0; i < count; i++) {
+        if (skip[i]) continue;
+        size_t dramSize = DramCircularLinkedList::nodeSize(keys[i].size(), values[i].size());
+        if (dramSize > dramCapacity) continue;
+        existing[i] = keyIndex.find(keys[i], hashes[i]);
+        if (DramNode* node = KeyIndex::dramNode(existing[i])) {
+            if (dramSize > node->size) dramNeeded += dramSize - node->size;
+            continue;
+        }
+        if (NvmNode* node = KeyIndex::nvmNode(existing[i])) {
+            size_t nvmSize = NvmCircularLinkedList::nodeSize(keys[i].size(), values[i].size());
+            if (nvmSize > node->size) nvmNeeded += nvmSize - node->size;
+            continue;
+        }
+        // 准入過濾要逐一比較新key和victim，不能先替整批清出空間
+        if (!admissionSketch) dramNeeded += dramSize;
+    }
+
+    // 一次把空間清出來，超過容量的部分留給逐一寫入時處理。
+    // 清空間時pin住這批要更新的節點，它們不會被逐出或搬移，查詢結果仍然有效
+    for (size_t i = 0; i < count; i++) {
+        if (DramNode* node = KeyIndex::dramNode(existing[i])) node->pins++;
+        else if (NvmNode* node = KeyIndex::nvmNode(existing[i])) node->pins++;
+    }
+    dramNeeded = std::min(dramNeeded, dramCapacity);
+    while (dram_list.currentSize + dramNeeded > dramCapacity) {
+        if (!evictDramNode()) break;
+    }
+    nvmNeeded = std::min(nvmNeeded, nvmCapacity);
+    while (nvm_list.usedBytes() + nvmNeeded > nvmCapacity) {
+        if (!reclaimNvmSpace()) break;
+    }
+    for (size_t i = 0; i < count; i++) {
+        if (DramNode* node = KeyIndex::dramNode(existing[i])) node->pins--;
+        else if (NvmNode* node = KeyIndex::nvmNode(existing[i])) node->pins--;
+    }
+
+    uint64_t removals = keyIndex.removalCount();
+    size_t stored = 0;
+    for (size_t i = 0; i < count; i++) {
+        if (skip[i]) continue;
+        // 前面的寫入逐出或取代過節點時，之前的查詢結果可能已經失效，重新查詢
+        uintptr_t tagged = keyIndex.removalCount() == removals ? existing[i] : keyIndex.find(keys[i], hashes[i]);
+        if (putWithLookup(keys[i], values[i], hashes[i], tagged, 0)) stored++;
+    }
+    return stored;
+}
+
+void ClockCache::release(CacheHandle* handle) {
+    bool detached;
+    if (handle->isNvm) {
+        NvmNode* node = static_cast<NvmNode*>(handle->node);
+        node->pins--;
+        detached = keyIndex.find(node->keyView(), node->hash) != tagNode(node);
+    } else {
+        DramNode* node = static_cast<DramNode*>(handle->node);
+        node->pins--;
+        detached = keyIndex.find(node->keyView(), node->hash) != tagNode(node);
+        // 仍在環中的節點解除pin後可能重新成為交換候選
+        if (!detached && node->pins == 0) {
+            refreshSwapCandidate(node);
+        }
+    }
+    // 已被刪除的節點在最後一個handle釋放後回收
+    if (detached) {
+        reclaimRetired(false);
+    }
+}
+
+
+void ClockCache::setMigrationSink(std::function<bool(std::string_view key)> sink) {
+    migrationSink = std::move(sink);
+}
+
+void ClockCache::requestMigration(NvmNode* node) {
+    if (migrationSink) {
+        // 佇列滿時請求被丟棄，節點狀態不變，之後的寫入會再次提出請求
+        migrationSink(node->keyView());
+        return;
+    }
+    triggerSwapWithDRAM(node);
+}
+
+bool ClockCache::migrate(std::string_view key) {
+    // 請求排隊期間key可能已被覆寫、逐出或遷移，重新確認目前的節點
+    NvmNode* node = findNvm(key);
+    if (node == nullptr) return false;
+    unsigned int status = node->attributes.status;
+    if (status != NvmNode::Pre_Migration && status != NvmNode::Migration) return false;
+    drainReadBuffer();
+    triggerSwapWithDRAM(node);
+    notifyIfAboveWatermark();
+    return findDram(key) != nullptr;
+}
+
+void ClockCache::setEvictionWatermarks(double low, double high, std::function<void()> notifier) {
+    lowWatermarkRatio = low;
+    highWatermarkRatio = high;
+    updateWatermarks();
+    evictionNotifier = std::move(notifier);
+}
+
+void ClockCache::updateWatermarks() {
+    dramLowWatermark = static_cast<size_t>(dramCapacity * lowWatermarkRatio);
+    dramHighWatermark = static_cast<size_t>(dramCapacity * highWatermarkRatio);
+    nvmLowWatermark = static_cast<size_t>(nvmCapacity * lowWatermarkRatio);
+    nvmHighWatermark = static_cast<size_t>(nvmCapacity * highWatermarkRatio);
+    shadowLowWatermark = static_cast<size_t>(nvmShadowBudget * lowWatermarkRatio);
+    shadowHighWatermark = static_cast<size_t>(nvmShadowBudget * highWatermarkRatio);
+}
+
+void ClockCache::enableAdaptiveSplit(size_t minDram, size_t maxDram, size_t step, size_t ghostEntries) {
+    size_t total = dramCapacity + nvmCapacity;
+    minDramCapacity = std::min(minDram, total);
+    maxDramCapacity = std::min(std::max(maxDram, minDramCapacity), total);
+    adaptStep = step;
+    dramGhosts.reset(new GhostList(ghostEntries));
+    nvmGhosts.reset(new GhostList(ghostEntries));
+    resizeTiers(std::min(std::max(dramCapacity, minDramCapacity), maxDramCapacity));
+}
+
+void ClockCache::recordGhostHit(uint64_t hash) {
+    if (!dramGhosts) return;
+    // 和ARC相同：另一個ghost list越長，這次命中移動得越多
+    if (dramGhosts->take(hash)) {
+        size_t delta = adaptStep * std::max<size_t>(1, nvmGhosts->size() / std::max<size_t>(1, dramGhosts->size()));
+        resizeTiers(std::min(dramCapacity + delta, maxDramCapacity));
+    } else if (nvmGhosts->take(hash)) {
+        size_t delta = adaptStep * std::max<size_t>(1, dramGhosts->size() / std::max<size_t>(1, nvmGhosts->size()));
+        resizeTiers(dramCapacity > minDramCapacity + delta ? dramCapacity - delta : minDramCapacity);
+    }
+}
+
+void ClockCache::resizeTiers(size_t newDramCapacity) {
+    if (newDramCapacity == dramCapacity) return;
+    size_t total = dramCapacity + nvmCapacity;
+    dramCapacity = newDramCapacity;
+    nvmCapacity = total - newDramCapacity;
+    updateWatermarks();
+    splitAdaptations++;
+    // 不在這裡逐出，縮小的tier超出新容量的部分由之後的寫入或背景逐出處理
+    notifyIfAboveWatermark();
+}
+
+void ClockCache::notifyIfAboveWatermark() {
+    if (!evictionNotifier) return;
+    if (dram_list.currentSize > dramHighWatermark || nvm_list.usedBytes() > nvmHighWatermark ||
+        shadowAbove(shadowHighWatermark)) {
+        evictionNotifier();
+    }
+}
+
+bool ClockCache::nvmShadowFits(size_t keySize, const NvmNode* released) const {
+    if (nvmShadowBudget == 0) return true;
+    size_t shadow = nvm_list.shadowBytes + NvmCircularLinkedList::shadowFootprint(keySize);
+    if (released != nullptr) shadow -= NvmCircularLinkedList::shadowFootprint(released->keyLength);
+    return shadow <= nvmShadowBudget;
+}
+
+void ClockCache::setNvmShadowBudget(size_t bytes) {
+    nvmShadowBudget = bytes;
+    updateWatermarks();
+    while (shadowAbove(nvmShadowBudget) && evictNvmNode()) {}
+}
+
+bool ClockCache::backgroundEvict(size_t maxNodes) {
+    // 先套用累積的讀取事件，避免逐出剛被無鎖讀取過的節點
+    drainReadBuffer();
+    // 已經過期的節點先移除，不必逐出還有效的節點
+    size_t evicted = expireEntries(maxNodes);
+    while (evicted < maxNodes && dram_list.currentSize > dramLowWatermark) {
+        if (!evictDramNode()) break;
+        backgroundDramEvictions++;
+        evicted++;
+    }
+    // shadow超過水位時只有逐出NVM entry有幫助
+    while (evicted < maxNodes && (nvm_list.usedBytes() > nvmLowWatermark || shadowAbove(shadowLowWatermark))) {
+        // dead bytes先用compaction回收，壓縮不計入逐出次數
+        if (nvm_list.usedBytes() > nvmLowWatermark && nvm_list.isLogStructured() && compactNvm(1) > 0) {
+            evicted++;
+            continue;
+        }
+        if (!evictNvmNode()) break;
+        backgroundNvmEvictions++;
+        evicted++;
+    }
+    // 全部被pin住而無法逐出時也回報完成，等下次寫入再通知
+    return evicted < maxNodes;
+}
+
+ClockCache::EvictionStats ClockCache::evictionStats() const {
+    EvictionStats stats;
+    stats.foregroundDram = dramEvictions - backgroundDramEvictions;
+    stats.foregroundNvm = nvmEvictions - backgroundNvmEvictions;
+    stats.backgroundDram = backgroundDramEvictions;
+    stats.backgroundNvm = backgroundNvmEvictions;
+    stats.demoted = demotions;
+    return stats;
+}
 
 void ClockCache::triggerSwapWithDRAM(NvmNode* nvmNode) {
     unsigned int nvmNodeStatus = nvmNode->attributes.status;
-    size_t nvmNodeSize = sizeof(DramNode) + strlen(nvmNode->key) + 1 + strlen(nvmNode->data) + 1;
+    // 遷移後在DRAM中的大小
+    size_t nvmNodeSize = DramCircularLinkedList::nodeSize(nvmNode->keyLength, nvmNode->dataLength);
     if (nvmNodeStatus != 2 && nvmNodeStatus != 3) {
         // 如果NVM節點的狀態不是Pre-Migration或Migration，則不執行任何操作
         return;
     }
+    if (nvmNode->pins != 0) {
+        // 還有handle指向NVM中的資料，等之後的put再遷移
+        return;
+    }
     
     if (dram_list.head == nullptr) {
         // 如果DRAM列表为空，检查NVM节点是否可以迁移到DRAM中
         if (nvmNodeSize <= dramCapacity) {
             // 有足够空间迁移NVM节点到DRAM
-            string key(nvmNode->key);
-            string data(nvmNode->data);
-            dram_list.insertNode(key, data);
-            dram_cacheMap[key] = dram_list.head; // 这里我们假设插入后的节点成为了新的头节点
-            nvm_list.deleteNode(nvmNode);
-            nvm_cacheMap.erase(key);
+            DramNode* newNode = dram_list.insertPayload(nvmNode->payload(), nvmNode->keyLength, nvmNode->dataLength);
+            indexNode(newNode, nvmNode->hash);
+            transferExpiry(nvmNode, newNode);
+            eraseNvmNode(nvmNode);
         }
         //TODO nvmNodeSize > dramCapacity 不可能完成遷移
         return; 
     }
-    // 嘗試在DRAM中找到合適的節點進行交換
+    // 從候選集合中取出合適的DRAM節點進行交換
     bool foundSuitableDramNode = false;
-    DramNode* candidate = dram_list.head;
-    
-    do {
-        if ((candidate->attributes.status == 2 || candidate->attributes.status == 3) &&
-            candidate->attributes.reference == 0) {
-            // 找到了合適的DRAM節點進行交換
-            foundSuitableDramNode = true;
-            swapNodes(nvmNode, candidate); //swapNodes裡面要檢查Size
-            break;
-        } else if (candidate->attributes.reference == 1) {
-            candidate->attributes.reference = 0;
-        }
-        candidate = candidate->next;
-    } while (candidate != dram_list.head);
+    DramNode* candidate = takeSwapCandidate();
+    if (candidate != nullptr) {
+        // 找到了合適的DRAM節點進行交換
+        foundSuitableDramNode = true;
+        swapNodes(nvmNode, candidate); //swapNodes裡面要檢查Size
+    }
     //Dram 沒有符合條件的Node
     if (!foundSuitableDramNode && nvmNodeStatus == 3) {
         // 如果NVM節點狀態為Migration，但DRAM空間不足，則逐出DRAM節點
@@ -183,116 +979,189 @@ void ClockCache::triggerSwapWithDRAM(NvmNode* nvmNode) {
             //TODO: nvmNodeSize > dramCapacity 不可能完成遷移
             return;
         }
-        while (dram_list.currentSize + nvmNodeSize > dramCapacity) {
-            evictDramNode();
+        // 降級模式下逐出DRAM會再逐出NVM，先pin住要遷移的節點
+        nvmNode->pins++;
+        bool enoughSpace = true;
+        while (enoughSpace && dram_list.currentSize + nvmNodeSize > dramCapacity) {
+            enoughSpace = evictDramNode();
         }
+        nvmNode->pins--;
+        if (!enoughSpace) return;
         // 現在DRAM有足夠空間，執行NVM到DRAM的節點遷移
-        string key(nvmNode->key);
-        string data(nvmNode->data);
-        dram_list.insertNode(key, data);
-        dram_cacheMap[key] = dram_list.head->prev; 
-        nvm_list.deleteNode(nvmNode);
-        nvm_cacheMap.erase(key);
+        DramNode* newNode = dram_list.insertPayload(nvmNode->payload(), nvmNode->keyLength, nvmNode->dataLength);
+        indexNode(newNode, nvmNode->hash);
+        transferExpiry(nvmNode, newNode);
+        eraseNvmNode(nvmNode);
     }  else if (!foundSuitableDramNode && nvmNodeStatus == 2 && 
-        dram_list.currentSize + sizeof(DramNode) + strlen(nvmNode->key) + 1 + strlen(nvmNode->data) + 1 <= dramCapacity) {
+        dram_list.currentSize + nvmNodeSize <= dramCapacity) {
         // 如果NVM節點狀態为Pre-Migration，且DRAM有足够空间，則直接搬移節點
-        string key(nvmNode->key);
-        string data(nvmNode->data);
-        dram_list.insertNode(key, data);
-        dram_cacheMap[key] = dram_list.head->prev;
-        nvm_list.deleteNode(nvmNode);
-        nvm_cacheMap.erase(key);
+        DramNode* newNode = dram_list.insertPayload(nvmNode->payload(), nvmNode->keyLength, nvmNode->dataLength);
+        indexNode(newNode, nvmNode->hash);
+        transferExpiry(nvmNode, newNode);
+        eraseNvmNode(nvmNode);
     }
     //else do nothing
 }
 
-void ClockCache::evictDramNode() {
-    if (dram_list.head == nullptr) return; // 确保DRAM列表非空
+bool ClockCache::evictDramNode() {
+    DramNode* victim = selectDramVictim();
+    if (victim == nullptr) return false;
+    evictDramVictim(victim);
+    return true;
+}
 
-    DramNode* candidate = dram_list.head;
-    do {
-        if (candidate->attributes.reference == 0) {
-            // 找到第一个reference为0的节点，将其逐出
-            // 从DRAM链表和缓存映射中移除节点
-            dram_cacheMap.erase(candidate->key); // 假设DramNode有存储key
-            dram_list.deleteNode(candidate);
+DramNode* ClockCache::selectDramVictim() {
+    if (dram_list.head == nullptr) return nullptr; // 确保DRAM列表非空
 
-            return; // 完成逐出操作后返回
-        } else {
-            // 将reference位设置为0并继续遍历
-            candidate->attributes.reference = 0;
-            candidate = candidate->next;
+    // 从上次停下的位置继续扫描，而不是每次都从head开始
+    DramNode* start = dram_list.hand ? dram_list.hand : dram_list.head;
+    DramNode* candidate = start;
+    DramNode* fallback = nullptr; // 第一个被清除reference的节点
+    size_t scanned = 0; // 清除的reference位数，跳过被pin住的节点不计入
+    while (true) {
+        // 被pin住的节点直接跳过
+        if (candidate->pins == 0) {
+            // 已经过期的节点不论reference都优先逐出；清除次数达到上限时直接逐出目前的节点
+            if (scanned >= maxEvictionScan || isExpired(candidate->expiresAt) ||
+                !candidate->testAndClearReference()) {
+                break;
+            }
+            // reference位已设置为0，继续遍历；清除后可能成为交换候选
+            refreshSwapCandidate(candidate);
+            if (fallback == nullptr) fallback = candidate;
+            scanned++;
+        }
+        candidate = candidate->next;
+        // 绕回起点时没被pin住的节点都已清过，逐出第一个被清除的节点；整圈都被pin住时没有可以逐出的节点
+        if (candidate == start) {
+            candidate = fallback;
+            break;
         }
-    } while (candidate != dram_list.head); // 循环直到回到起点
+    }
+    // 停在找到的节点上，准入过滤拒绝新key时它仍是下一次的victim
+    if (candidate != nullptr) dram_list.hand = candidate;
+    return candidate;
+}
 
-    // 如果所有节点的reference位都已经是0，但仍然需要逐出节点，则选择头节点逐出
-    // 这是一个后备方案，实际中应该很少发生，因为上面的逻辑已经尝试将所有节点的reference置为0
-    if (candidate == dram_list.head) {
-        dram_cacheMap.erase(candidate->key);
-        dram_list.deleteNode(candidate);
+void ClockCache::evictDramVictim(DramNode* victim) {
+    // 从DRAM链表和缓存映射中移除节点，hand会在unlink时移到下一个节点
+    // 过期的节点不降级，也不记录到ghost list
+    bool expired = isExpired(victim->expiresAt);
+    if (demoteEvictions && !expired && victim->attributes.status >= demoteMinStatus) {
+        demoteToNvm(victim);
+    } else {
+        if (dramGhosts && !expired) dramGhosts->add(victim->hash);
+        eraseDramNode(victim);
     }
+    dramEvictions++;
+}
+
+void ClockCache::enableDemotion(unsigned int minStatus) {
+    demoteEvictions = true;
+    demoteMinStatus = minStatus;
 }
 
-void ClockCache::evictNvmNode() {
-    if (nvm_list.head == nullptr) return; // 确保NVM列表非空
+void ClockCache::demoteToNvm(DramNode* node) {
+    size_t nvmNodeSize = NvmCircularLinkedList::nodeSize(node->keyLength, node->dataLength);
+    bool enoughSpace = nvmNodeSize <= nvmCapacity;
+    while (enoughSpace && nvm_list.usedBytes() + nvm_list.appendBytes(nvmNodeSize) > nvmCapacity) {
+        enoughSpace = reclaimNvmSpace();
+    }
+    while (enoughSpace && !nvmShadowFits(node->keyLength, nullptr)) {
+        enoughSpace = evictNvmNode();
+    }
+    // NVM放不下時退回直接丟棄
+    NvmNode* newNode = nullptr;
+    if (enoughSpace) {
+        newNode = nvm_list.insertPayload(node->key, node->keyLength, node->dataLength, node->expiresAt);
+        // 剛降級的節點沒有待遷移的寫入，給一輪clock的保護
+        newNode->attributes.reference = 1;
+        transferExpiry(node, newNode);
+    }
+    uint64_t hash = node->hash;
+    eraseDramNode(node);
+    if (newNode != nullptr) {
+        indexNode(newNode, hash);
+        demotions++;
+    }
+}
 
-    NvmNode* candidate = nvm_list.head;
-    do {
-        if (candidate->attributes.reference == 0) {
-            // 找到第一个reference为0的节点，将其逐出
-            // 从NVM链表和缓存映射中移除节点
-            nvm_cacheMap.erase(candidate->key); // 假设NvmNode有存储key
-            nvm_list.deleteNode(candidate);
+bool ClockCache::evictNvmNode() {
+    if (nvm_list.head == nullptr) return false; // 确保NVM列表非空
 
-            return; // 完成逐出操作后返回
-        } else {
-            // 将reference位设置为0并继续遍历
-            candidate->attributes.reference = 0;
-            candidate = candidate->next;
+    // 从上次停下的位置继续扫描，而不是每次都从head开始
+    NvmNode* start = nvm_list.hand ? nvm_list.hand : nvm_list.head;
+    NvmNode* candidate = start;
+    NvmNode* fallback = nullptr; // 第一个被清除reference的节点
+    size_t scanned = 0; // 清除的reference位数，跳过被pin住的节点不计入
+    while (true) {
+        // 被pin住的节点直接跳过
+        if (candidate->pins == 0) {
+            if (scanned >= maxEvictionScan || isExpired(candidate->expiresAt) ||
+                !candidate->testAndClearReference()) {
+                break;
+            }
+            // reference位已设置为0，继续遍历
+            if (fallback == nullptr) fallback = candidate;
+            scanned++;
+        }
+        candidate = candidate->next;
+        // 绕回起点时没被pin住的节点都已清过，逐出第一个被清除的节点；整圈都被pin住时没有可以逐出的节点
+        if (candidate == start) {
+            candidate = fallback;
+            break;
         }
-    } while (candidate != nvm_list.head); // 循环直到回到起点
-
-    // 如果所有节点的reference位都已经是0，但仍然需要逐出节点，则选择头节点逐出
-    // 这是一个后备方案，实际中应该很少发生，因为上面的逻辑已经尝试将所有节点的reference置为0
-    if (candidate == nvm_list.head) {
-        nvm_cacheMap.erase(candidate->key);
-        nvm_list.deleteNode(candidate);
     }
+    if (candidate == nullptr) return false;
+
+    // 找到第一个reference为0的节点，将其逐出
+    // 从NVM链表和缓存映射中移除节点，hand会在unlink时移到下一个节点
+    nvm_list.hand = candidate;
+    if (nvmGhosts && !isExpired(candidate->expiresAt)) nvmGhosts->add(candidate->hash);
+    eraseNvmNode(candidate);
+    nvmEvictions++;
+    return true;
 }
 
 void ClockCache::swapNodes(NvmNode* nvmNode, DramNode* dramNode) {
-    size_t dramNodeSize = dramNode->size;
-    size_t nvmNodeSize = nvmNode->size;
+    // 交換後兩筆資料在對方tier中的大小
+    size_t toDramSize = DramCircularLinkedList::nodeSize(nvmNode->keyLength, nvmNode->dataLength);
+    size_t toNvmSize = NvmCircularLinkedList::nodeSize(dramNode->keyLength, dramNode->dataLength);
 
-    // 清出空間讓兩個Node可以安全交換
-    while (dram_list.currentSize - dramNodeSize + nvmNodeSize > dramCapacity) {
-        evictDramNode();
+    // 清出空間讓兩個Node可以安全交換，交換中的兩個節點先pin住以免被逐出
+    dramNode->pins++;
+    nvmNode->pins++;
+    bool enoughSpace = true;
+    while (enoughSpace && dram_list.currentSize - dramNode->size + toDramSize > dramCapacity) {
+        enoughSpace = evictDramNode();
     }
-    while (nvm_list.currentSize - nvmNodeSize + dramNodeSize > nvmCapacity) {
-        evictNvmNode();
+    while (enoughSpace && nvm_list.usedBytes() - nvm_list.releasableBytes(nvmNode) + nvm_list.appendBytes(toNvmSize) >
+                              nvmCapacity) {
+        enoughSpace = reclaimNvmSpace();
+    }
+    while (enoughSpace && !nvmShadowFits(dramNode->keyLength, nvmNode)) {
+        enoughSpace = evictNvmNode();
+    }
+    dramNode->pins--;
+    nvmNode->pins--;
+    if (!enoughSpace) {
+        refreshSwapCandidate(dramNode);
+        return;
     }
 
-    //執行交換
-    string dramKey(dramNode->key);
-    string dramData(dramNode->data);
-    string nvmKey(nvmNode->key);
-    string nvmData(nvmNode->data);
-
-    dram_list.deleteNode(dramNode);
-    dram_cacheMap.erase(dramKey);
-
-    nvm_list.deleteNode(nvmNode);
-    nvm_cacheMap.erase(nvmKey);
-
-    // 使用保存的数据将DRAM节点迁移到NVM
-    nvm_list.insertNode(dramKey, dramData);
-    auto newNvmNode = nvm_list.head->prev; // 获取新插入的NVM节点
-    nvm_cacheMap[dramKey] = newNvmNode;
+    //執行交換：兩個tier的payload格式相同，直接從舊節點整段複製到對方tier的新節點
+    NvmNode* newNvmNode = nvm_list.insertPayload(dramNode->key, dramNode->keyLength, dramNode->dataLength,
+                                                 dramNode->expiresAt);
+    DramNode* newDramNode = dram_list.insertPayload(nvmNode->payload(), nvmNode->keyLength, nvmNode->dataLength);
+    transferExpiry(dramNode, newNvmNode);
+    transferExpiry(nvmNode, newDramNode);
+    uint64_t dramHash = dramNode->hash;
+    uint64_t nvmHash = nvmNode->hash;
 
-    // 使用保存的数据将NVM节点迁移到DRAM
-    dram_list.insertNode(nvmKey, nvmData);
-    auto newDramNode = dram_list.head->prev; // 获取新插入的DRAM节点
-    dram_cacheMap[nvmKey] = newDramNode;
+    eraseDramNode(dramNode);
+    eraseNvmNode(nvmNode);
+    indexNode(newNvmNode, dramHash);
+    indexNode(newDramNode, nvmHash);
 
     // TODO: 更新节点的状态或其他属性，标记为最近访问
     newNvmNode->attributes.reference = 1;
@@ -1,14 +1,64 @@
 #include "NvmCircularList.h"
 #include "DramCircularList.h"
 #include "pm_manager.h"
+#include "Epoch.h"
+#include "ConcurrentReadIndex.h"
+#include "ReadBuffer.h"
+#include "KeyIndex.h"
+#include "FrequencySketch.h"
+#include "GhostList.h"
+#include "TimingWheel.h"
 #include <iostream>
-#include <unordered_map>
 #include <string>
+#include <string_view>
+#include <functional>
 #include <list>
+#include <memory>
+#include <mutex>
+#include <vector>
 #include <gtest/gtest.h>
 
 using std::string;
-using std::unordered_map;
+
+// key的hash，KeyIndex、ConcurrentReadIndex與ShardedClockCache的分片共用
+struct StringHash {
+    using is_transparent = void;
+    size_t operator()(std::string_view key) const {
+        return std::hash<std::string_view>()(key);
+    }
+};
+
+class ClockCache;
+
+// getOrLoad()從來源載入的value要放入的tier
+// Dram和put()相同；Nvm直接寫入NVM環(狀態為Initial)，之後被讀取時再依一般規則遷移
+enum class LoadTier { Dram, Nvm };
+
+// lookup()回傳的零拷貝讀取handle
+// value()直接指向DRAM或NVM中的資料，handle存在期間節點被pin住，不會被逐出、交換或釋放。
+// handle只能移動不能複製，解構或release()時解除pin。
+class CacheHandle
+{
+public:
+    CacheHandle() : cache(nullptr), node(nullptr), isNvm(false), mutex(nullptr) {}
+    CacheHandle(CacheHandle&& other) noexcept;
+    CacheHandle& operator=(CacheHandle&& other) noexcept;
+    CacheHandle(const CacheHandle&) = delete;
+    CacheHandle& operator=(const CacheHandle&) = delete;
+    ~CacheHandle() { release(); }
+
+    explicit operator bool() const { return node != nullptr; }
+    std::string_view value() const;
+    void release();
+
+private:
+    friend class ClockCache;
+    friend class ShardedClockCache;
+    ClockCache* cache;
+    void* node;
+    bool isNvm;
+    std::mutex* mutex;  // 非nullptr時，release()需要先取得這個鎖(ShardedClockCache的shard鎖)
+};
 
 // 採用clock-RWRF cache algorithm
 class ClockCache
@@ -18,19 +68,252 @@ private:
     PMmanager *pm;
     NvmCircularLinkedList nvm_list;
     DramCircularLinkedList dram_list;
-    unordered_map<string, NvmNode*> nvm_cacheMap;
-    unordered_map<string, DramNode*> dram_cacheMap;
+    // key -> DRAM或NVM節點，同一個key只會在其中一個tier，一次探測就能找到
+    KeyIndex keyIndex;
     size_t dramCapacity;
     size_t nvmCapacity;
+    // NVM entry的DRAM shadow的上限(0表示不限制)，放入新的NVM entry前超過時逐出NVM entry
+    size_t nvmShadowBudget;
+    size_t maxEvictionScan; // 每次逐出最多清除幾個reference位
+
+    // 背景逐出：使用量超過high時呼叫evictionNotifier，由背景執行緒逐出到low以下
+    size_t dramLowWatermark, dramHighWatermark;
+    size_t nvmLowWatermark, nvmHighWatermark;
+    size_t shadowLowWatermark, shadowHighWatermark;  // nvmShadowBudget的水位，沒有設定預算時不使用
+    double lowWatermarkRatio, highWatermarkRatio;
+    std::function<void()> evictionNotifier;
+    void notifyIfAboveWatermark();
+    bool shadowAbove(size_t bytes) const { return nvmShadowBudget != 0 && nvm_list.shadowBytes > bytes; }
+    // 放入key長度為keySize的NVM entry後shadow是否仍在預算內，released是同時離開NVM的entry(可為nullptr)
+    bool nvmShadowFits(size_t keySize, const NvmNode* released) const;
+    // 依目前的容量重新計算水位
+    void updateWatermarks();
+    // 全部逐出次數與其中由backgroundEvict()完成的次數，相減就是前景逐出的次數
+    uint64_t dramEvictions, nvmEvictions;
+    uint64_t backgroundDramEvictions, backgroundNvmEvictions;
+
+    // 降級模式：DRAM逐出的節點寫入NVM而不是丟棄，DRAM與NVM成為互斥的兩層cache
+    bool demoteEvictions;
+    unsigned int demoteMinStatus; // 只降級status(讀取次數)不低於這個值的節點
+    uint64_t demotions;
+    void demoteToNvm(DramNode* node);
+
+    // 暖啟動：解構時NVM節點留在pool中，不釋放
+    bool warmRestart;
+
+    // getOrLoad()載入的value放入的tier
+    LoadTier loadTier;
+    // 把key直接寫入NVM環(狀態為Initial)，NVM放不下時回傳false
+    bool insertIntoNvm(std::string_view key, std::string_view value, uint64_t hash, uint64_t expiresAt);
+    // put()查完索引之後的部分，existing是key目前在keyIndex中的節點(沒有時為0)，multiPut共用
+    bool putWithLookup(std::string_view key, std::string_view value, uint64_t hash, uintptr_t existing,
+                       uint64_t expiresAt);
+
+    // TTL：有過期時間的節點登記在timerWheel，put()與背景逐出時以小批次移除已經過期的節點。
+    // 讀取遇到過期的節點時當作沒有命中並移除，clock掃描時過期的節點優先被逐出
+    static constexpr uint64_t kTimerTickMs = 1000;
+    static constexpr size_t kForegroundExpireBatch = 16;
+    std::function<uint64_t()> clock;  // 目前時間(毫秒)
+    std::unique_ptr<TimingWheel> timerWheel;
+    uint64_t expirations;
+    bool isExpired(uint64_t expiresAt) const { return expiresAt != 0 && expiresAt <= clock(); }
+    template <typename Node> void scheduleExpiry(Node* node);
+    template <typename Node> void cancelExpiry(Node* node);
+    // timerWheel到期時呼叫，被pin住的節點回傳false留到下一個tick
+    bool expireNode(TimerEntry* entry);
+
+    // TinyLFU准入：所有存取都記錄在admissionSketch，DRAM滿時新key要比clock選出的victim熱才會進DRAM，
+    // 否則放入NVM(rejectToNvm)或直接不放入
+    std::unique_ptr<FrequencySketch> admissionSketch;
+    bool admissionRejectToNvm;
+    uint64_t admissionRejections;
+    void recordAccess(uint64_t hash) {
+        if (admissionSketch) admissionSketch->increment(hash);
+    }
+    // clock掃描選出下一個要逐出的DRAM節點(會清除掃過節點的reference位)，沒有可以逐出的節點時回傳nullptr
+    DramNode* selectDramVictim();
+    void evictDramVictim(DramNode* victim);
+
+    // 自適應容量分配(ARC式)：兩個tier各有記錄最近被逐出key的ghost list，沒有命中的key出現在
+    // DRAM的ghost list表示DRAM太小，出現在NVM的ghost list表示NVM太小。命中時把adaptStep bytes
+    // (另一個ghost list較長時按比例放大)移給該tier，dramCapacity + nvmCapacity維持不變，
+    // dramCapacity限制在[minDramCapacity, maxDramCapacity]。縮小的tier在之後的寫入或背景逐出時降到新容量
+    std::unique_ptr<GhostList> dramGhosts;
+    std::unique_ptr<GhostList> nvmGhosts;
+    size_t minDramCapacity, maxDramCapacity;
+    size_t adaptStep;
+    uint64_t splitAdaptations;
+    void recordGhostHit(uint64_t hash);
+    void resizeTiers(size_t newDramCapacity);
+
+    // log-structured NVM：sealed segment平均live比例低於nvmCompactionRatio時呼叫compactionNotifier，
+    // 由背景執行緒呼叫compactNvm()
+    double nvmCompactionRatio;
+    std::function<void()> compactionNotifier;
+    uint64_t nvmCompactions;
+    bool compacting;  // compactNvm()執行中，搬移record時的刪除不再通知
+    // 把節點的record複製到目前的segment，索引改指向新節點，舊節點和一般刪除一樣移除
+    void relocateNvmNode(NvmNode* node);
+    // 為NVM騰出空間：log-structured時逐出sealed segment中的節點不會減少usedBytes()，
+    // 所以先壓縮一個live比例低的segment，沒有可以壓縮的segment時才逐出一個節點
+    bool reclaimNvmSpace();
+
+    // status為2/3且reference為0的DRAM節點，在status/reference改變時增量維護，
+    // triggerSwapWithDRAM直接從這裡取交換對象，不需要掃描整個DRAM環
+    std::vector<DramNode*> swapCandidates;
+    void refreshSwapCandidate(DramNode* node);
+    void removeSwapCandidate(DramNode* node);
+    DramNode* takeSwapCandidate();
+
+
+    // 無鎖讀取模式(enableOptimisticReads)使用
+    struct RetiredNode {
+        uint64_t epoch;
+        void* node;
+        bool isNvm;
+    };
+    static constexpr size_t kReclaimThreshold = 64;
+    static constexpr size_t kDefaultMaxEvictionScan = 256;
+    EpochManager *epoch;
+    std::unique_ptr<ConcurrentReadIndex> readIndex;
+    std::unique_ptr<ReadBuffer> readBuffer;
+    std::vector<RetiredNode> retired;
+
+    //從cache map與環中移除節點，無鎖讀取模式下延後到grace period之後才釋放，
+    //被pin住的節點延後到最後一個handle釋放之後
+    void eraseDramNode(DramNode* node);
+    void eraseNvmNode(NvmNode* node);
+    void reclaimRetired(bool force);
+
+    static uint64_t hashKey(std::string_view key);
+    //查詢key所在的節點，不在該tier時回傳nullptr
+    DramNode* findDram(std::string_view key) const;
+    NvmNode* findNvm(std::string_view key) const;
+    //設定節點的hash並放入索引，key原本指向的節點(不論哪個tier)會被取代
+    void indexNode(DramNode* node, uint64_t hash);
+    void indexNode(NvmNode* node, uint64_t hash);
+
+    //NVM節點的寫入狀態到達Pre_Migration/Migration時呼叫：有sink時交給sink，否則直接遷移
+    std::function<bool(std::string_view key)> migrationSink;
+    void requestMigration(NvmNode* node);
+
+    //找到key並套用讀取命中的狀態更新，get()與lookup()共用
+    bool touch(std::string_view key, DramNode** dramNode, NvmNode** nvmNode);
+    friend class CacheHandle;
+    void release(CacheHandle* handle);
 public:
     ClockCache(PMmanager *pm, size_t dramSize, size_t nvmSize);
     ~ClockCache();
-    void put(const string& key, const string& value);
-    bool get(const string& key, string* value);
+    // ttlMs大於0時，ttlMs毫秒後過期；覆寫時新的TTL(或沒有TTL)取代舊的。
+    // 回傳value是否寫入：清不出空間(節點都被pin住)或被准入過濾丟棄時回傳false，已存在的key保留舊的value
+    bool put(std::string_view key, std::string_view value, uint64_t ttlMs = 0);
+    bool get(std::string_view key, string* value);
+    // 和get()相同的命中語意，但不複製value；找不到時回傳空的handle
+    CacheHandle lookup(std::string_view key);
+
+    // 批次操作：先算好所有key的hash並預取索引與節點，再一次複製value與更新狀態
+    // values/found會被resize成keys.size()，回傳命中的數量
+    size_t multiGet(const std::vector<std::string_view>& keys, std::vector<string>* values,
+                    std::vector<bool>* found);
+    // 先為整批新key一次清出DRAM/NVM空間，之後逐一寫入時就不需要再逐出。
+    // 每個key只算一次hash、查一次索引，重複的key只寫入最後一個value。
+    // 回傳寫入的key數量(重複的key只算一次)，keys與values長度不同時不寫入並回傳0
+    size_t multiPut(const std::vector<std::string_view>& keys, const std::vector<std::string_view>& values);
+
+    // 讀穿(read-through)：沒有命中時呼叫loader向來源取得value，loader回傳false表示來源也沒有這個key，
+    // 取得的value依loadTier放入cache。ClockCache不是thread-safe，合併同一個key的並行load見ShardedClockCache
+    using Loader = std::function<bool(std::string_view key, string* value)>;
+    bool getOrLoad(std::string_view key, string* value, const Loader& loader);
+    // 放入loader取得的value；load期間key已經被put時保留寫入的值，回傳value是否被放入
+    bool insertLoaded(std::string_view key, std::string_view value);
+    void setLoadTier(LoadTier tier) { loadTier = tier; }
+
+    // 開啟無鎖讀取：get()命中的節點會被放入readIndex，之後的命中可由getOptimistic()不加鎖完成。
+    // 寫入操作(put/get/evict...)仍需由呼叫者以鎖串行化，例如ShardedClockCache的shard鎖。
+    void enableOptimisticReads(EpochManager* epoch, size_t indexCapacity);
+    // 不加鎖查詢readIndex，找不到時回傳false，呼叫者應退回加鎖的get()
+    // 命中時只把存取事件寫入readBuffer，不修改節點；needDrain表示buffer已累積足夠事件
+    bool getOptimistic(std::string_view key, string* value, bool* needDrain = nullptr);
+    // 需持有寫入鎖：把readBuffer中的存取事件套用到節點的reference/status
+    void drainReadBuffer();
+
+    // 設定後put()不再直接在呼叫者的執行緒上遷移NVM節點，而是把key交給sink(例如背景執行緒的佇列)
+    // sink回傳false表示請求被丟棄
+    void setMigrationSink(std::function<bool(std::string_view key)> sink);
+    // 需持有寫入鎖：key仍在NVM且符合遷移條件時執行遷移，回傳key是否已移到DRAM
+    bool migrate(std::string_view key);
+
     void triggerSwapWithDRAM(NvmNode* node);
     //This function is used to evict node from dram or nvm cache
-    void evictDramNode();
-    void evictNvmNode();
+    //從各tier的clock hand開始掃描，最多清除maxEvictionScan個reference位後就強制逐出目前的節點。
+    //被pin住的節點直接跳過、不計入上限，整圈都被pin住時才逐出失敗
+    void setMaxEvictionScan(size_t maxScan) { maxEvictionScan = maxScan; }
+
+    // 設定背景逐出的水位(容量的比例，low < high)
+    // 寫入後使用量超過high時呼叫notifier(持有寫入鎖)，背景執行緒再呼叫backgroundEvict()
+    void setEvictionWatermarks(double low, double high, std::function<void()> notifier);
+    // 需持有寫入鎖：最多逐出maxNodes個節點，回傳兩個tier是否都已降到low以下
+    bool backgroundEvict(size_t maxNodes);
+    struct EvictionStats {
+        uint64_t foregroundDram;
+        uint64_t foregroundNvm;
+        uint64_t backgroundDram;
+        uint64_t backgroundNvm;
+        uint64_t demoted;  // 逐出時降級到NVM的DRAM節點數
+    };
+    EvictionStats evictionStats() const;
+    // NVM entry在DRAM中的shadow(鏈結、狀態位元與key)佔用的bytes。shadow不計入dramCapacity也不計入nvmCapacity，
+    // 隨NVM中的entry數增加：NVM放滿小value時，DRAM實際使用量是dramCapacity加上這個值
+    size_t nvmShadowBytes() const { return nvm_list.shadowBytes; }
+    // 限制shadow佔用的DRAM(0表示不限制)：放入NVM entry前超過預算時逐出NVM entry，
+    // 背景逐出的水位同樣套用在shadow上。設定時超過的部分立即逐出
+    void setNvmShadowBudget(size_t bytes);
+    // 開啟降級：DRAM逐出的節點若status >= minStatus就搬到NVM(狀態為Initial)，
+    // NVM不夠時先逐出NVM；minStatus為Initial時所有逐出的節點都降級
+    void enableDemotion(unsigned int minStatus = DramNode::Initial);
+    // 開啟TinyLFU准入過濾(expectedEntries決定sketch大小)：DRAM需要逐出時，新key的估計頻率
+    // 必須高於clock victim才會放入DRAM，否則rejectToNvm時寫入NVM，不然就不放入
+    void enableAdmissionFilter(size_t expectedEntries, bool rejectToNvm = true);
+    uint64_t admissionRejectionCount() const { return admissionRejections; }
+
+    // 開啟自適應容量分配：兩個tier的容量總和不變，dramCapacity在[minDram, maxDram]之間依ghost命中移動，
+    // 每次移動step bytes；每個ghost list最多記錄ghostEntries個key。NVM的容量最多會變成總和減minDram，
+    // pool必須放得下
+    void enableAdaptiveSplit(size_t minDram, size_t maxDram, size_t step, size_t ghostEntries);
+    size_t dramBudget() const { return dramCapacity; }
+    size_t nvmBudget() const { return nvmCapacity; }
+    uint64_t splitAdaptationCount() const { return splitAdaptations; }
+
+    // 需持有寫入鎖：從timing wheel取出已經過期的節點並移除，最多處理maxEntries個，回傳移除的數量
+    size_t expireEntries(size_t maxEntries);
+    uint64_t expirationCount() const { return expirations; }
+    // 換掉取得目前時間(毫秒)的函式，預設為system_clock。NVM record中的過期時間在暖啟動後仍然使用，
+    // 所以必須是跨重啟一致的wall clock。必須在第一次寫入有TTL的key之前呼叫
+    void setClock(std::function<uint64_t()> nowMs) { clock = std::move(nowMs); }
+    //回傳false表示沒有可以逐出的節點(tier為空或全部被pin住)
+    bool evictDramNode();
+    bool evictNvmNode();
+
+    // 開啟暖啟動：解構時NVM節點留在pool中(DRAM內容仍然捨棄)，下次開啟pool後用recover()找回
+    void enableWarmRestart() { warmRestart = true; }
+    // 開啟暖啟動並從pool找回上次留下的NVM節點、重建索引，回傳找回的節點數量
+    // 必須在第一次寫入之前呼叫；同一個pool由多個cache共用時改用ShardedClockCache::recover()
+    size_t recover();
+    // 為一個從pool找回的NVM record建立DRAM端的節點(狀態為Initial)，同一個key保留version較新的record，
+    // NVM容量不夠時直接釋放，回傳record是否被放入
+    bool adoptNvmRecord(NvmRecord* record);
+
+    // NVM改為log-structured：新record依序append到segmentSize大小的segment，刪除只標記Retired，
+    // 空間由compactNvm()回收。notifier在需要compaction時被呼叫(持有寫入鎖)
+    void enableLogStructuredNvm(size_t segmentSize = NvmCircularLinkedList::kDefaultSegmentSize,
+                                double compactionRatio = 0.5, std::function<void()> notifier = nullptr);
+    // 需持有寫入鎖：最多壓縮maxSegments個live比例低於compactionRatio的segment，
+    // 把仍在使用的record搬到目前的segment，回傳清空的segment數(0表示沒有可以壓縮的segment)。
+    // 被pin住的record不搬移，它所在的segment留到下一次。
+    // sealed segment中的dead bytes計入NVM容量，寫入時NVM不夠也會在前景壓縮
+    size_t compactNvm(size_t maxSegments);
+    bool needsNvmCompaction() const { return nvm_list.needsCompaction(nvmCompactionRatio); }
+    uint64_t nvmCompactionCount() const { return nvmCompactions; }
 
     //This function is used to swap a DRAM node with an NVM node. 
     //When using it, ensure that both the DRAM cache and the NVM cache have enough space available for the swap.
@@ -54,6 +337,46 @@ public:
     FRIEND_TEST(ClockCacheTest, NvmNodeTwiceReadAndStateTransition);
     FRIEND_TEST(ClockCacheTest, KeyNotFoundInBothDramAndNvm);
     FRIEND_TEST(ClockCacheTest, GetAndPut);
+    FRIEND_TEST(ClockCacheTest, OptimisticGetAfterPublish);
+    FRIEND_TEST(ClockCacheTest, OptimisticReadsDeferNodeReclamation);
+    FRIEND_TEST(ClockCacheTest, ReadBufferDropsEventsOfErasedNodes);
+    FRIEND_TEST(ClockCacheTest, EvictionResumesFromClockHand);
+    FRIEND_TEST(ClockCacheTest, EvictionScanIsBounded);
+    FRIEND_TEST(ClockCacheTest, EvictionSkipsPinnedRunLongerThanScanLimit);
+    FRIEND_TEST(ClockCacheTest, SwapCandidatesTrackStatusAndReference);
+    FRIEND_TEST(ClockCacheTest, StringViewKeysWithoutNulTermination);
+    FRIEND_TEST(ClockCacheTest, PinnedNodeIsNotEvicted);
+    FRIEND_TEST(ClockCacheTest, HandleKeepsOverwrittenNodeAlive);
+    FRIEND_TEST(ClockCacheTest, PinnedNvmNodeIsNotMigrated);
+    FRIEND_TEST(ClockCacheTest, MultiGetReadsBothTiers);
+    FRIEND_TEST(ClockCacheTest, MultiPutEvictsOnceForBatch);
+    FRIEND_TEST(ClockCacheTest, OverwriteInPlaceKeepsDramNode);
+    FRIEND_TEST(ClockCacheTest, OverwriteInPlaceKeepsNvmNode);
+    FRIEND_TEST(ClockCacheTest, OverwriteSkipsPinnedAndPublishedNodes);
+    FRIEND_TEST(ClockCacheTest, OverwriteKeepsOldValueWhenEvictionIsBlocked);
+    FRIEND_TEST(ClockCacheTest, MigrationSinkDefersPromotion);
+    FRIEND_TEST(ClockCacheTest, BackgroundEvictionHonorsWatermarks);
+    FRIEND_TEST(ClockCacheTest, NvmShadowBudgetEvictsNvmEntries);
+    FRIEND_TEST(ClockCacheTest, DemoteDramVictimsToNvm);
+    FRIEND_TEST(ClockCacheTest, DemotionFiltersByReadStatus);
+    FRIEND_TEST(ClockCacheTest, BinaryKeysAndValuesSurviveTierTransfer);
+    FRIEND_TEST(ClockCacheTest, RecoverNvmTierAfterRestart);
+    FRIEND_TEST(ClockCacheTest, RecoverDiscardsTornAndStaleNodes);
+    FRIEND_TEST(ClockCacheTest, NvmReadsAndSweepsLeaveRecordsUntouched);
+    FRIEND_TEST(ClockCacheTest, CompactNvmRelocatesLiveRecords);
+    FRIEND_TEST(ClockCacheTest, GetOrLoadPlacesValueByLoadTier);
+    FRIEND_TEST(ClockCacheTest, AdmissionFilterKeepsHotSetAgainstScan);
+    FRIEND_TEST(ClockCacheTest, GhostHitsShiftCapacityBetweenTiers);
+    FRIEND_TEST(ClockCacheTest, ExpiredEntriesAreMissesAndReclaimedByWheel);
+    FRIEND_TEST(ClockCacheTest, TtlFollowsEntriesAcrossTiersAndRestart);
+    FRIEND_TEST(ClockCacheTest, ArenaReturnsSlabsWhenValueSizesShift);
+    FRIEND_TEST(ClockCacheTest, LogStructuredNvmChargesDeadBytes);
+    FRIEND_TEST(ShardedClockCacheTest, CapacityIsSplitAcrossShards);
+    FRIEND_TEST(ShardedClockCacheTest, BackgroundMigrationPromotesNvmKeys);
+    FRIEND_TEST(ShardedClockCacheTest, BackgroundEvictionKeepsShardsBelowHighWatermark);
+    FRIEND_TEST(ShardedClockCacheTest, RecoverRoutesNodesToNewShardCount);
+    FRIEND_TEST(ShardedClockCacheTest, BackgroundCompactionReclaimsSegments);
+    FRIEND_TEST(ShardedClockCacheTest, GetOrLoadCoalescesConcurrentMisses);
     
 };
 
@@ -14,6 +14,15 @@ protected:
         clockCache = new ClockCache(pm, dramSize, nvmSize);
     }
 
+    // 把直接插入list的節點放入cache的key索引
+    void indexNode(DramNode* node) {
+        clockCache->indexNode(node, ClockCache::hashKey(node->keyView()));
+    }
+
+    void indexNode(NvmNode* node) {
+        clockCache->indexNode(node, ClockCache::hashKey(node->keyView()));
+    }
+
     void TearDown() override {
         delete clockCache;
         delete pm;
@@ -129,23 +138,29 @@ TEST_F(ClockCacheTest, TriggerSwapWithDRAM) {
     DramNode* dramNode = clockCache->dram_list.head;
     dramNode->attributes.status = 2; // 假设2代表Pre-Migration或Migration
     dramNode->attributes.reference = 0;
+    clockCache->refreshSwapCandidate(dramNode);
+    indexNode(dramNode);
 
     // 插入一个NVM节点，并设定其状态为Migration
     // 使用NvmCircularLinkedList的insertNode方法插入节点
     clockCache->nvm_list.insertNode("nvmKey1", "nvmData1");
     NvmNode* nvmNode = clockCache->nvm_list.head; // 假设新插入的节点成为了头节点
     nvmNode->attributes.status = 3; // 设置状态为Migration
+    indexNode(nvmNode);
 
     // 执行交换
     clockCache->triggerSwapWithDRAM(nvmNode);
 
     // 验证：交换后，原NVM节点的键值应该在DRAM中找到
-    bool isSwappedToDram = clockCache->dram_cacheMap.find("nvmKey1") != clockCache->dram_cacheMap.end();
+    bool isSwappedToDram = clockCache->findDram("nvmKey1") != nullptr;
     EXPECT_TRUE(isSwappedToDram);
 
     // 验证：原DRAM节点应该被逐出或交换到NVM中
-    bool isOriginalDramNodeEvicted = clockCache->dram_cacheMap.find("dramKey1") == clockCache->dram_cacheMap.end();
+    bool isOriginalDramNodeEvicted = clockCache->findDram("dramKey1") == nullptr;
     EXPECT_TRUE(isOriginalDramNodeEvicted);
+    // 原DRAM節點是從候選集合中取出，應該被交換到NVM
+    EXPECT_TRUE(clockCache->findNvm("dramKey1") != nullptr);
+    EXPECT_TRUE(clockCache->swapCandidates.empty());
 
     // 注意：确保在测试结束时适当地管理内存
 }
@@ -158,16 +173,17 @@ TEST_F(ClockCacheTest, TriggerSwapWithMigrationStateAndDramFull) {
     clockCache->nvm_list.insertNode("nvmKeyMigration", "nvmDataMigration");
     NvmNode* nvmNode = clockCache->nvm_list.head;
     nvmNode->attributes.status = NvmNode::Migration; // 设置状态为Migration
+    indexNode(nvmNode);
 
     // 执行交换
     clockCache->triggerSwapWithDRAM(nvmNode);
 
     // 验证DRAM中现在有新插入的NVM节点数据
-    bool isNvmDataInDram = clockCache->dram_cacheMap.find("nvmKeyMigration") != clockCache->dram_cacheMap.end();
+    bool isNvmDataInDram = clockCache->findDram("nvmKeyMigration") != nullptr;
     EXPECT_TRUE(isNvmDataInDram);
 
     // 验证原NVM节点是否已经被正确逐出或交换到DRAM中
-    bool isNvmNodeEvicted = clockCache->nvm_cacheMap.find("nvmKeyMigration") == clockCache->nvm_cacheMap.end();
+    bool isNvmNodeEvicted = clockCache->findNvm("nvmKeyMigration") == nullptr;
     EXPECT_TRUE(isNvmNodeEvicted);
 }
 
@@ -179,12 +195,13 @@ TEST_F(ClockCacheTest, TriggerSwapWithPreMigrationStateAndDramFull) {
     clockCache->nvm_list.insertNode("nvmKeyPreMigration", "nvmDataPreMigration");
     NvmNode* nvmNode = clockCache->nvm_list.head;
     nvmNode->attributes.status = NvmNode::Pre_Migration; // 设置状态为Pre-Migration
+    indexNode(nvmNode);
 
     // 执行交换
     clockCache->triggerSwapWithDRAM(nvmNode);
 
     // 验证：DRAM不应该包含Pre-Migration状态的NVM节点数据，因为不强制交换
-    bool isNvmDataInDram = clockCache->dram_cacheMap.find("nvmKeyPreMigration") != clockCache->dram_cacheMap.end();
+    bool isNvmDataInDram = clockCache->findDram("nvmKeyPreMigration") != nullptr;
     EXPECT_FALSE(isNvmDataInDram);
 }
 
@@ -196,17 +213,18 @@ TEST_F(ClockCacheTest, TriggerSwapWithPreMigrationStateAndDramNotFull) {
     clockCache->nvm_list.insertNode("nvmKeyPreMigrationNotFull", "nvmDataPreMigrationNotFull");
     NvmNode* nvmNode = clockCache->nvm_list.head;
     nvmNode->attributes.status = NvmNode::Pre_Migration; // 设置状态为Pre-Migration
+    indexNode(nvmNode);
 
     // 执行交换
     clockCache->triggerSwapWithDRAM(nvmNode);
 
     // 验证：如果DRAM中找到了对应的NVM节点数据，说明进行了交换
-    bool isNvmDataInDram = clockCache->dram_cacheMap.find("nvmKeyPreMigrationNotFull") != clockCache->dram_cacheMap.end();
+    bool isNvmDataInDram = clockCache->findDram("nvmKeyPreMigrationNotFull") != nullptr;
     EXPECT_TRUE(isNvmDataInDram);
 
 
     // 验证原NVM节点是否已经被正确逐出或交换到DRAM中
-    bool isNvmNodeEvicted = clockCache->nvm_cacheMap.find("nvmKeyPreMigrationNotFull") == clockCache->nvm_cacheMap.end();
+    bool isNvmNodeEvicted = clockCache->findNvm("nvmKeyPreMigrationNotFull") == nullptr;
     EXPECT_TRUE(isNvmNodeEvicted);
 }
 
@@ -215,13 +233,13 @@ TEST_F(ClockCacheTest, SwapNodes) {
     string dramKey = "dramKey";
     string dramData = "dramData";
     clockCache->dram_list.insertNode(dramKey, dramData);
-    clockCache->dram_cacheMap[dramKey] = clockCache->dram_list.head; // 假设最后一个插入的节点成为头节点
+    indexNode(clockCache->dram_list.head); // 假设最后一个插入的节点成为头节点
 
     // 插入一个NVM节点
     string nvmKey = "nvmKey";
     string nvmData = "nvmData";
     clockCache->nvm_list.insertNode(nvmKey, nvmData);
-    clockCache->nvm_cacheMap[nvmKey] = clockCache->nvm_list.head; // 同上
+    indexNode(clockCache->nvm_list.head); // 同上
 
     // 获取插入的DRAM和NVM节点
     DramNode* dramNode = clockCache->dram_list.head;
@@ -232,16 +250,16 @@ TEST_F(ClockCacheTest, SwapNodes) {
 
     // 验证交换后的结果
     // 验证原NVM节点的数据现在在DRAM中
-    bool isNvmDataInDram = clockCache->dram_cacheMap.find(nvmKey) != clockCache->dram_cacheMap.end();
+    bool isNvmDataInDram = clockCache->findDram(nvmKey) != nullptr;
     EXPECT_TRUE(isNvmDataInDram);
 
     // 验证原DRAM节点的数据现在在NVM中
-    bool isDramDataInNvm = clockCache->nvm_cacheMap.find(dramKey) != clockCache->nvm_cacheMap.end();
+    bool isDramDataInNvm = clockCache->findNvm(dramKey) != nullptr;
     EXPECT_TRUE(isDramDataInNvm);
 
     // 验证缓存映射是否正确更新
-    EXPECT_EQ(clockCache->dram_cacheMap[nvmKey]->data, nvmData);
-    EXPECT_EQ(clockCache->nvm_cacheMap[dramKey]->data, dramData);
+    EXPECT_EQ(clockCache->findDram(nvmKey)->data, nvmData);
+    EXPECT_EQ(clockCache->findNvm(dramKey)->data, dramData);
 }
 
 TEST_F(ClockCacheTest, UpdateValueInDram) {
@@ -252,13 +270,13 @@ TEST_F(ClockCacheTest, UpdateValueInDram) {
     // 直接插入初始值到DRAM链表并更新DRAM缓存映射
     clockCache->dram_list.insertNode(key, initialValue); 
     DramNode* insertedNode = clockCache->dram_list.head->prev; 
-    clockCache->dram_cacheMap[key] = insertedNode; 
+    indexNode(insertedNode); 
 
     clockCache->put(key, updatedValue);
 
-    auto it = clockCache->dram_cacheMap.find(key);
-    bool found = (it != clockCache->dram_cacheMap.end());
-    string retrievedValue = found ? it->second->data : "";
+    DramNode* node = clockCache->findDram(key);
+    bool found = node != nullptr;
+    string retrievedValue = found ? node->data : "";
 
     EXPECT_TRUE(found);
     EXPECT_EQ(retrievedValue, updatedValue);
@@ -272,22 +290,22 @@ TEST_F(ClockCacheTest, UpdateAndMigrateFromNvm) {
     // 直接插入初始值到NVM并更新NVM缓存映射
     clockCache->nvm_list.insertNode(key, initialValue);
     NvmNode* insertedNvmNode = clockCache->nvm_list.head; // 假设插入后成为头节点
-    clockCache->nvm_cacheMap[key] = insertedNvmNode;
+    indexNode(insertedNvmNode);
     insertedNvmNode->attributes.status = NvmNode::Initial; // 显式设置初始状态
     
     // 第一次更新
     clockCache->put(key, updatedValue);
     // 验证更新后的值及状态
-    EXPECT_EQ(std::string(clockCache->nvm_cacheMap[key]->data), updatedValue);
-    EXPECT_EQ(clockCache->nvm_cacheMap[key]->attributes.status, NvmNode::Be_Written);
+    EXPECT_EQ(std::string(clockCache->findNvm(key)->data), updatedValue);
+    EXPECT_EQ(clockCache->findNvm(key)->attributes.status, NvmNode::Be_Written);
 
     // 第二次更新，模拟状态更新到Pre_Migration
     string updatedValue2 = "updatedValue2";
     clockCache->put(key, updatedValue2);
     // 由于NVM节点状态应该更新到Pre_Migration，并触发迁移，所以我们需要验证迁移是否成功
-    EXPECT_TRUE(clockCache->dram_cacheMap.find(key) != clockCache->dram_cacheMap.end()); // 确认迁移至DRAM
-    EXPECT_EQ(std::string(clockCache->dram_cacheMap[key]->data), updatedValue2); // 确认DRAM中的数据是最新的
-    EXPECT_TRUE(clockCache->nvm_cacheMap.find(key) == clockCache->nvm_cacheMap.end()); // 确认从NVM中移除
+    EXPECT_TRUE(clockCache->findDram(key) != nullptr); // 确认迁移至DRAM
+    EXPECT_EQ(std::string(clockCache->findDram(key)->data), updatedValue2); // 确认DRAM中的数据是最新的
+    EXPECT_TRUE(clockCache->findNvm(key) == nullptr); // 确认从NVM中移除
 }
 
 TEST_F(ClockCacheTest, InsertNewNodeIntoDramWhenNotPresentInBoth) {
@@ -298,16 +316,15 @@ TEST_F(ClockCacheTest, InsertNewNodeIntoDramWhenNotPresentInBoth) {
     clockCache->put(key, value);
     
     // 验证key是否被插入到了DRAM中
-    auto itDram = clockCache->dram_cacheMap.find(key);
-    bool isInsertedInDram = (itDram != clockCache->dram_cacheMap.end());
+    DramNode* dramNode = clockCache->findDram(key);
+    bool isInsertedInDram = dramNode != nullptr;
     EXPECT_TRUE(isInsertedInDram);
     if (isInsertedInDram) {
-        EXPECT_EQ(std::string(itDram->second->data), value);
+        EXPECT_EQ(std::string(dramNode->data), value);
     }
     
     // 验证key是否不存在于NVM中
-    auto itNvm = clockCache->nvm_cacheMap.find(key);
-    bool isNotPresentInNvm = (itNvm == clockCache->nvm_cacheMap.end());
+    bool isNotPresentInNvm = clockCache->findNvm(key) == nullptr;
     EXPECT_TRUE(isNotPresentInNvm);
 }
 
@@ -321,12 +338,12 @@ TEST_F(ClockCacheTest, EvictNodeWhenDramIsFull) {
     clockCache->put(extraKey, extraValue);
     
     // 验证新节点是否成功插入到DRAM中
-    auto itExtra = clockCache->dram_cacheMap.find(extraKey);
-    bool isExtraInserted = (itExtra != clockCache->dram_cacheMap.end());
+    DramNode* extraNode = clockCache->findDram(extraKey);
+    bool isExtraInserted = extraNode != nullptr;
     EXPECT_TRUE(isExtraInserted);
     if (isExtraInserted) {
         // 验证插入的数据是否正确
-        EXPECT_EQ(std::string(itExtra->second->data), extraValue);
+        EXPECT_EQ(std::string(extraNode->data), extraValue);
     }
 
     // 验证DRAM空间是否通过逐出节点以适应新节点插入而得到维护
@@ -340,7 +357,7 @@ TEST_F(ClockCacheTest, GetValueFromDram) {
     
     // 直接向DRAM插入一個節點
     clockCache->dram_list.insertNode(key, value);
-    clockCache->dram_cacheMap[key] = clockCache->dram_list.head->prev; // 假設插入後成為尾節點
+    indexNode(clockCache->dram_list.head->prev); // 假設插入後成為尾節點
     
     string retrievedValue;
     bool found = clockCache->get(key, &retrievedValue);
@@ -350,7 +367,7 @@ TEST_F(ClockCacheTest, GetValueFromDram) {
     EXPECT_EQ(retrievedValue, value);
 
     // 驗證引用位和狀態是否被正確更新
-    auto dramNode = clockCache->dram_cacheMap[key];
+    auto dramNode = clockCache->findDram(key);
     EXPECT_EQ(dramNode->attributes.reference, 1); // 驗證引用位被設置為1
     EXPECT_EQ(dramNode->getStatus(), DramNode::Once_read); // 驗證狀態更新為Once_read
 }
@@ -363,7 +380,7 @@ TEST_F(ClockCacheTest, GetValueFromNvm) {
     
     clockCache->nvm_list.insertNode(key, value); 
     NvmNode* newNode = clockCache->nvm_list.head->prev;
-    clockCache->nvm_cacheMap[key] = newNode;
+    indexNode(newNode);
     
     string retrievedValue;
     bool found = clockCache->get(key, &retrievedValue);
@@ -373,7 +390,7 @@ TEST_F(ClockCacheTest, GetValueFromNvm) {
     EXPECT_EQ(retrievedValue, value);
 
     // 驗證`twiceRead`位和狀態更新
-    auto nvmNode = clockCache->nvm_cacheMap[key];
+    auto nvmNode = clockCache->findNvm(key);
     EXPECT_EQ(nvmNode->attributes.twiceRead, 1); // 驗證twiceRead被設置為1
     // 假設初始狀態為Initial，則這裡不改變狀態，只設置twiceRead
 }
@@ -385,7 +402,7 @@ TEST_F(ClockCacheTest, DramNodeStateTransition) {
     // 直接插入DRAM節點並設置初始狀態
     clockCache->dram_list.insertNode(key, value);
     auto dramNode = clockCache->dram_list.head->prev;
-    clockCache->dram_cacheMap[key] = dramNode;
+    indexNode(dramNode);
     dramNode->setStatus(DramNode::Initial);
 
     // 第一次讀取，應該將狀態從Initial更新為Once_read
@@ -412,7 +429,7 @@ TEST_F(ClockCacheTest, NvmNodeTwiceReadAndStateTransition) {
     clockCache->nvm_list.insertNode(key, value); 
     NvmNode* newNode = clockCache->nvm_list.head->prev;
     newNode->setStatus(NvmNode::Be_Written);
-    clockCache->nvm_cacheMap[key] = newNode;
+    indexNode(newNode);
 
     // 第一次讀取，應設置twiceRead為1，但不更新狀態
     string retrievedValue1;
@@ -432,8 +449,8 @@ TEST_F(ClockCacheTest, KeyNotFoundInBothDramAndNvm) {
     string value;
 
     // 確認鍵不在DRAM及NVM中
-    bool foundInDram = clockCache->dram_cacheMap.find(missingKey) != clockCache->dram_cacheMap.end();
-    bool foundInNvm = clockCache->nvm_cacheMap.find(missingKey) != clockCache->nvm_cacheMap.end();
+    bool foundInDram = clockCache->findDram(missingKey) != nullptr;
+    bool foundInNvm = clockCache->findNvm(missingKey) != nullptr;
     EXPECT_FALSE(foundInDram);
     EXPECT_FALSE(foundInNvm);
 
@@ -455,18 +472,993 @@ TEST_F(ClockCacheTest, GetAndPut) {
     // 驗證是否正確檢索到值，並檢查狀態和引用位的更新
     EXPECT_TRUE(found);
     EXPECT_EQ(value, retrievedValue);
-    auto dramNode = clockCache->dram_cacheMap.find(key)->second;
+    auto dramNode = clockCache->findDram(key);
     EXPECT_EQ(1, dramNode->attributes.reference); // 驗證引用位被設置為1
     EXPECT_EQ(DramNode::Once_read, dramNode->getStatus()); // 驗證狀態更新為Once_read
 }
 
+TEST_F(ClockCacheTest, OptimisticGetAfterPublish) {
+    EpochManager epoch;
+    clockCache->enableOptimisticReads(&epoch, 64);
+    string key = "optimisticKey";
+    string value = "optimisticValue";
+    clockCache->put(key, value);
+
+    // 節點在第一次加鎖的get()命中後才會被放入readIndex
+    string retrievedValue;
+    EXPECT_FALSE(clockCache->getOptimistic(key, &retrievedValue));
+    EXPECT_TRUE(clockCache->get(key, &retrievedValue));
+
+    retrievedValue.clear();
+    auto dramNode = clockCache->findDram(key);
+    dramNode->attributes.reference = 0;
+    EXPECT_TRUE(clockCache->getOptimistic(key, &retrievedValue));
+    EXPECT_EQ(retrievedValue, value);
+
+    // 無鎖命中只記錄事件，drain之後才更新節點
+    EXPECT_EQ(dramNode->attributes.reference, 0);
+    EXPECT_EQ(dramNode->getStatus(), DramNode::Once_read);
+    clockCache->drainReadBuffer();
+    EXPECT_EQ(dramNode->attributes.reference, 1);
+    EXPECT_EQ(dramNode->getStatus(), DramNode::Twice_read);
+
+    EXPECT_FALSE(clockCache->getOptimistic("missingKey", &retrievedValue));
+}
+
+TEST_F(ClockCacheTest, OptimisticReadsDeferNodeReclamation) {
+    EpochManager epoch;
+    clockCache->enableOptimisticReads(&epoch, 64);
+    string key = "retireKey";
+    string retrievedValue;
+    clockCache->put(key, "oldValue");
+    clockCache->get(key, &retrievedValue);
+
+    {
+        // 有讀者停留在舊epoch時，被覆寫的節點不能被釋放
+        EpochManager::Guard guard(&epoch);
+        clockCache->put(key, "newValue");
+        EXPECT_EQ(clockCache->retired.size(), 1);
+        clockCache->reclaimRetired(false);
+        EXPECT_EQ(clockCache->retired.size(), 1);
+    }
+    clockCache->reclaimRetired(false);
+    EXPECT_EQ(clockCache->retired.size(), 0);
+
+    // 舊節點已從readIndex移除，新節點尚未放入
+    EXPECT_FALSE(clockCache->getOptimistic(key, &retrievedValue));
+    EXPECT_TRUE(clockCache->get(key, &retrievedValue));
+    EXPECT_EQ(retrievedValue, "newValue");
+}
+
+TEST_F(ClockCacheTest, ReadBufferDropsEventsOfErasedNodes) {
+    EpochManager epoch;
+    clockCache->enableOptimisticReads(&epoch, 64);
+    string key = "bufferedKey";
+    string retrievedValue;
+    clockCache->put(key, "bufferedValue");
+    clockCache->get(key, &retrievedValue);
+    EXPECT_TRUE(clockCache->getOptimistic(key, &retrievedValue));
+
+    // 節點在事件被套用之前就被刪除並釋放，drain時不能再碰它
+    clockCache->eraseDramNode(clockCache->findDram(key));
+    clockCache->reclaimRetired(false);
+    EXPECT_EQ(clockCache->retired.size(), 0);
+    clockCache->drainReadBuffer();
+    EXPECT_FALSE(clockCache->get(key, &retrievedValue));
+}
+
+TEST_F(ClockCacheTest, EvictionResumesFromClockHand) {
+    for (int i = 0; i < 4; ++i) {
+        clockCache->put("handKey" + std::to_string(i), "handValue");
+    }
+    DramNode* first = clockCache->findDram("handKey0");
+    DramNode* second = clockCache->findDram("handKey1");
+
+    // 所有節點reference都是1，繞一圈清除後逐出起點，hand停在下一個節點
+    clockCache->evictDramNode();
+    EXPECT_TRUE(clockCache->findDram("handKey0") == nullptr);
+    EXPECT_EQ(clockCache->dram_list.hand, second);
+    EXPECT_NE(clockCache->dram_list.head, first);
+
+    // 下一次逐出從hand開始，不必再重新掃描前面的節點
+    clockCache->put("handKey0", "handValue");
+    clockCache->evictDramNode();
+    EXPECT_TRUE(clockCache->findDram("handKey1") == nullptr);
+    EXPECT_EQ(clockCache->dram_list.hand, clockCache->findDram("handKey2"));
+}
+
+TEST_F(ClockCacheTest, EvictionScanIsBounded) {
+    clockCache->setMaxEvictionScan(2);
+    for (int i = 0; i < 4; ++i) {
+        clockCache->put("scanKey" + std::to_string(i), "scanValue");
+    }
+
+    // 只清除兩個reference位，第三個節點被強制逐出
+    clockCache->evictDramNode();
+    EXPECT_EQ(clockCache->findDram("scanKey0")->attributes.reference, 0);
+    EXPECT_EQ(clockCache->findDram("scanKey1")->attributes.reference, 0);
+    EXPECT_TRUE(clockCache->findDram("scanKey2") == nullptr);
+    EXPECT_EQ(clockCache->findDram("scanKey3")->attributes.reference, 1);
+    EXPECT_EQ(clockCache->dram_list.hand, clockCache->findDram("scanKey3"));
+}
+
+TEST_F(ClockCacheTest, EvictionSkipsPinnedRunLongerThanScanLimit) {
+    clockCache->setMaxEvictionScan(2);
+    for (int i = 0; i < 6; ++i) {
+        clockCache->put("pinKey" + std::to_string(i), "pinValue");
+        indexNode(clockCache->nvm_list.insertNode("nvmPinKey" + std::to_string(i), "pinValue"));
+    }
+    clockCache->put("freeKey", "freeValue");
+    indexNode(clockCache->nvm_list.insertNode("nvmFreeKey", "freeValue"));
+
+    // hand後面連續被pin住的節點比掃描上限多，跳過它們不計入上限
+    for (int i = 0; i < 6; ++i) {
+        clockCache->findDram("pinKey" + std::to_string(i))->pins++;
+        clockCache->findNvm("nvmPinKey" + std::to_string(i))->pins++;
+    }
+    clockCache->dram_list.hand = clockCache->findDram("pinKey0");
+    clockCache->nvm_list.hand = clockCache->findNvm("nvmPinKey0");
+    EXPECT_TRUE(clockCache->evictDramNode());
+    EXPECT_TRUE(clockCache->findDram("freeKey") == nullptr);
+    EXPECT_TRUE(clockCache->evictNvmNode());
+    EXPECT_TRUE(clockCache->findNvm("nvmFreeKey") == nullptr);
+
+    // 整圈都被pin住時才逐出失敗
+    EXPECT_FALSE(clockCache->evictDramNode());
+    EXPECT_FALSE(clockCache->evictNvmNode());
+    for (int i = 0; i < 6; ++i) {
+        EXPECT_TRUE(clockCache->findDram("pinKey" + std::to_string(i)) != nullptr);
+        EXPECT_TRUE(clockCache->findNvm("nvmPinKey" + std::to_string(i)) != nullptr);
+        clockCache->findDram("pinKey" + std::to_string(i))->pins--;
+        clockCache->findNvm("nvmPinKey" + std::to_string(i))->pins--;
+    }
+}
+
+TEST_F(ClockCacheTest, SwapCandidatesTrackStatusAndReference) {
+    string value;
+    clockCache->put("hotKey", "hotValue");
+    clockCache->get("hotKey", &value);
+    clockCache->get("hotKey", &value);
+    clockCache->put("otherKey", "otherValue");
+    DramNode* hotNode = clockCache->findDram("hotKey");
+    EXPECT_EQ(hotNode->getStatus(), DramNode::Twice_read);
+    // reference為1時不能被交換
+    EXPECT_TRUE(clockCache->swapCandidates.empty());
+
+    // clock sweep清除hotKey的reference後，它成為交換候選
+    clockCache->setMaxEvictionScan(1);
+    clockCache->evictDramNode();
+    ASSERT_EQ(clockCache->swapCandidates.size(), 1);
+    EXPECT_EQ(clockCache->swapCandidates[0], hotNode);
+
+    // 再次被讀取後reference為1，從集合中移除
+    clockCache->get("hotKey", &value);
+    EXPECT_TRUE(clockCache->swapCandidates.empty());
+    EXPECT_EQ(hotNode->swapIndex, DramNode::kNotSwapCandidate);
+}
+
+TEST_F(ClockCacheTest, StringViewKeysWithoutNulTermination) {
+    // 呼叫者的buffer不一定以'\0'結尾，key/value只能依長度讀取
+    const char buffer[] = "viewKeyviewValueTrailing";
+    std::string_view key(buffer, 7);
+    std::string_view value(buffer + 7, 9);
+    clockCache->put(key, value);
+
+    string retrievedValue;
+    EXPECT_TRUE(clockCache->get(std::string_view("viewKey"), &retrievedValue));
+    EXPECT_EQ(retrievedValue, "viewValue");
+    EXPECT_TRUE(clockCache->findDram(std::string_view(buffer, 7)) != nullptr);
+    EXPECT_FALSE(clockCache->get(std::string_view(buffer, 8), &retrievedValue));
+}
+
+TEST_F(ClockCacheTest, PinnedNodeIsNotEvicted) {
+    clockCache->put("pinnedKey", "pinnedValue");
+    CacheHandle handle = clockCache->lookup("pinnedKey");
+    ASSERT_TRUE(handle);
+    EXPECT_EQ(handle.value(), "pinnedValue");
+    EXPECT_EQ(clockCache->findDram("pinnedKey")->pins, 1);
+
+    // 寫入大量新key逼迫逐出，被pin住的節點要留下來
+    for (int i = 0; i < 50; ++i) {
+        clockCache->put("fillKey" + std::to_string(i), "fillValue");
+    }
+    EXPECT_TRUE(clockCache->findDram("pinnedKey") != nullptr);
+    EXPECT_EQ(handle.value(), "pinnedValue");
+    EXPECT_LE(clockCache->dram_list.currentSize, clockCache->dramCapacity);
+
+    handle.release();
+    EXPECT_FALSE(handle);
+    EXPECT_EQ(clockCache->findDram("pinnedKey")->pins, 0);
+    EXPECT_FALSE(clockCache->lookup("missingKey"));
+}
+
+TEST_F(ClockCacheTest, HandleKeepsOverwrittenNodeAlive) {
+    clockCache->put("handleKey", "oldValue");
+    CacheHandle handle = clockCache->lookup("handleKey");
+
+    // 覆寫後舊節點離開cache，但在handle釋放前不能被釋放
+    clockCache->put("handleKey", "newValue");
+    EXPECT_EQ(clockCache->retired.size(), 1);
+    EXPECT_EQ(handle.value(), "oldValue");
+    string value;
+    EXPECT_TRUE(clockCache->get("handleKey", &value));
+    EXPECT_EQ(value, "newValue");
+
+    CacheHandle moved = std::move(handle);
+    EXPECT_FALSE(handle);
+    EXPECT_EQ(moved.value(), "oldValue");
+    moved.release();
+    EXPECT_EQ(clockCache->retired.size(), 0);
+}
+
+TEST_F(ClockCacheTest, PinnedNvmNodeIsNotMigrated) {
+    clockCache->nvm_list.insertNode("nvmPinnedKey", "nvmPinnedValue");
+    NvmNode* nvmNode = clockCache->nvm_list.head;
+    indexNode(nvmNode);
+    CacheHandle handle = clockCache->lookup("nvmPinnedKey");
+    EXPECT_EQ(handle.value(), "nvmPinnedValue");
+
+    nvmNode->setStatus(NvmNode::Migration);
+    clockCache->triggerSwapWithDRAM(nvmNode);
+    EXPECT_TRUE(clockCache->findNvm("nvmPinnedKey") != nullptr);
+    EXPECT_TRUE(clockCache->findDram("nvmPinnedKey") == nullptr);
+
+    handle.release();
+    clockCache->triggerSwapWithDRAM(nvmNode);
+    EXPECT_TRUE(clockCache->findDram("nvmPinnedKey") != nullptr);
+}
+
+TEST_F(ClockCacheTest, MultiGetReadsBothTiers) {
+    clockCache->put("dramKey", "dramValue");
+    clockCache->nvm_list.insertNode("nvmKey", "nvmValue");
+    indexNode(clockCache->nvm_list.head);
+
+    std::vector<std::string_view> keys = {"nvmKey", "missingKey", "dramKey"};
+    std::vector<string> values;
+    std::vector<bool> found;
+    EXPECT_EQ(clockCache->multiGet(keys, &values, &found), 2);
+    ASSERT_EQ(values.size(), 3);
+    EXPECT_TRUE(found[0]);
+    EXPECT_EQ(values[0], "nvmValue");
+    EXPECT_FALSE(found[1]);
+    EXPECT_TRUE(found[2]);
+    EXPECT_EQ(values[2], "dramValue");
+
+    // 命中要和get()一樣更新狀態
+    EXPECT_EQ(clockCache->findDram("dramKey")->attributes.status, DramNode::Once_read);
+    EXPECT_EQ(clockCache->findDram("dramKey")->attributes.reference, 1);
+    EXPECT_EQ(clockCache->findNvm("nvmKey")->attributes.twiceRead, 1);
+}
+
+TEST_F(ClockCacheTest, MultiPutEvictsOnceForBatch) {
+    for (int i = 0; i < 20; ++i) {
+        clockCache->put("oldKey" + std::to_string(i), "oldValue");
+    }
+    std::vector<string> keyStorage;
+    for (int i = 0; i < 4; ++i) {
+        keyStorage.push_back("batchKey" + std::to_string(i));
+    }
+    std::vector<std::string_view> keys(keyStorage.begin(), keyStorage.end());
+    std::vector<std::string_view> values(keys.size(), "batchValue");
+    EXPECT_EQ(clockCache->multiPut(keys, values), keys.size());
+
+    EXPECT_LE(clockCache->dram_list.currentSize, clockCache->dramCapacity);
+    std::vector<string> retrieved;
+    std::vector<bool> found;
+    EXPECT_EQ(clockCache->multiGet(keys, &retrieved, &found), keys.size());
+    for (const string& value : retrieved) {
+        EXPECT_EQ(value, "batchValue");
+    }
+
+    // 重複的key只寫入最後一個value，估算空間時也只算一次
+    uint64_t evictionsBefore = clockCache->dramEvictions;
+    std::vector<std::string_view> repeated = {"batchKey0", "newKey", "newKey", "newKey", "batchKey0"};
+    std::vector<std::string_view> repeatedValues = {"first", "value1", "value2", "value3", "second"};
+    EXPECT_EQ(clockCache->multiPut(repeated, repeatedValues), 2);
+    EXPECT_EQ(clockCache->dramEvictions - evictionsBefore, 1);
+    string value;
+    EXPECT_TRUE(clockCache->get("newKey", &value));
+    EXPECT_EQ(value, "value3");
+    EXPECT_TRUE(clockCache->get("batchKey0", &value));
+    EXPECT_EQ(value, "second");
+
+    // keys與values長度不同時不寫入
+    repeatedValues.pop_back();
+    EXPECT_EQ(clockCache->multiPut(repeated, repeatedValues), 0);
+    EXPECT_TRUE(clockCache->get("batchKey0", &value));
+    EXPECT_EQ(value, "second");
+}
+
+TEST_F(ClockCacheTest, OverwriteInPlaceKeepsDramNode) {
+    clockCache->put("counterKey", "0001");
+    clockCache->put("otherKey", "otherValue");
+    DramNode* node = clockCache->findDram("counterKey");
+    size_t sizeBefore = clockCache->dram_list.currentSize;
+
+    // 狀態為Initial時更新不能讓status往下溢位
+    clockCache->put("counterKey", "0002");
+    EXPECT_EQ(clockCache->findDram("counterKey"), node);
+    EXPECT_EQ(clockCache->dram_list.head, node);
+    EXPECT_EQ(clockCache->dram_list.currentSize, sizeBefore);
+    EXPECT_STREQ(node->data, "0002");
+    EXPECT_EQ(node->attributes.status, DramNode::Initial);
+
+    // 較短的value也原地覆寫
+    node->setStatus(DramNode::Twice_read);
+    clockCache->put("counterKey", "3");
+    EXPECT_EQ(clockCache->findDram("counterKey"), node);
+    EXPECT_STREQ(node->data, "3");
+    EXPECT_EQ(node->attributes.status, DramNode::Once_read);
+    EXPECT_EQ(node->attributes.reference, 1);
+
+    // 放不下時重新配置
+    string longValue(200, 'x');
+    clockCache->put("counterKey", longValue);
+    EXPECT_NE(clockCache->findDram("counterKey"), node);
+    string value;
+    EXPECT_TRUE(clockCache->get("counterKey", &value));
+    EXPECT_EQ(value, longValue);
+}
+
+TEST_F(ClockCacheTest, OverwriteInPlaceKeepsNvmNode) {
+    clockCache->nvm_list.insertNode("nvmCounterKey", "0001");
+    NvmNode* node = clockCache->nvm_list.head;
+    indexNode(node);
+    size_t sizeBefore = clockCache->nvm_list.currentSize;
+
+    clockCache->put("nvmCounterKey", "0002");
+    EXPECT_EQ(clockCache->findNvm("nvmCounterKey"), node);
+    EXPECT_EQ(clockCache->nvm_list.currentSize, sizeBefore);
+    EXPECT_STREQ(node->data, "0002");
+    EXPECT_EQ(node->attributes.status, NvmNode::Be_Written);
+
+    // 第二次寫入進入Pre_Migration，DRAM有空間時遷移
+    clockCache->put("nvmCounterKey", "0003");
+    EXPECT_TRUE(clockCache->findNvm("nvmCounterKey") == nullptr);
+    string value;
+    EXPECT_TRUE(clockCache->get("nvmCounterKey", &value));
+    EXPECT_EQ(value, "0003");
+}
+
+TEST_F(ClockCacheTest, OverwriteSkipsPinnedAndPublishedNodes) {
+    clockCache->put("pinnedKey", "oldValue");
+    DramNode* node = clockCache->findDram("pinnedKey");
+    {
+        CacheHandle handle = clockCache->lookup("pinnedKey");
+        clockCache->put("pinnedKey", "newValue");
+        EXPECT_NE(clockCache->findDram("pinnedKey"), node);
+        EXPECT_EQ(handle.value(), "oldValue");
+    }
 
+    // 放入readIndex後無鎖讀者可能正在讀，也不能原地覆寫
+    EpochManager epochManager;
+    clockCache->enableOptimisticReads(&epochManager, 64);
+    string value;
+    EXPECT_TRUE(clockCache->get("pinnedKey", &value));
+    node = clockCache->findDram("pinnedKey");
+    clockCache->put("pinnedKey", "newValue2");
+    EXPECT_NE(clockCache->findDram("pinnedKey"), node);
+    EXPECT_TRUE(clockCache->getOptimistic("pinnedKey", &value) == false || value == "newValue2");
+    clockCache->reclaimRetired(true);
+}
 
+TEST_F(ClockCacheTest, OverwriteKeepsOldValueWhenEvictionIsBlocked) {
+    // 填滿DRAM直到找不到可以逐出的節點，之後只有要覆寫的key沒有被pin住
+    clockCache->put("dramKey", "oldValue");
+    CacheHandle dramHandle = clockCache->lookup("dramKey");
+    std::vector<CacheHandle> handles;
+    for (int i = 0; clockCache->put("fillKey" + std::to_string(i), "fillValue"); ++i) {
+        handles.push_back(clockCache->lookup("fillKey" + std::to_string(i)));
+    }
+    dramHandle.release();
+    ASSERT_TRUE(clockCache->findDram("dramKey") != nullptr);
+    EXPECT_FALSE(clockCache->put("dramKey", string(200, 'n')));
+    string value;
+    EXPECT_TRUE(clockCache->get("dramKey", &value));
+    EXPECT_EQ(value, "oldValue");
+    // 放得進舊節點的bytes時仍然可以寫入
+    EXPECT_TRUE(clockCache->put("dramKey", "newValue"));
+    EXPECT_TRUE(clockCache->get("dramKey", &value));
+    EXPECT_EQ(value, "newValue");
+
+    // NVM：其他record都被pin住，新的value放不進原本的record也清不出空間
+    std::vector<NvmNode*> pinned;
+    indexNode(clockCache->nvm_list.insertNode("nvmKey", "oldValue"));
+    for (int i = 0; clockCache->nvm_list.currentSize + 200 < clockCache->nvmCapacity; ++i) {
+        NvmNode* node = clockCache->nvm_list.insertNode("nvmFillKey" + std::to_string(i), "fillValue");
+        indexNode(node);
+        node->pins++;
+        pinned.push_back(node);
+    }
+    EXPECT_FALSE(clockCache->put("nvmKey", string(400, 'n')));
+    ASSERT_TRUE(clockCache->findNvm("nvmKey") != nullptr);
+    EXPECT_EQ(clockCache->findNvm("nvmKey")->dataView(), "oldValue");
+    for (NvmNode* node : pinned) {
+        node->pins--;
+    }
+}
+
+TEST_F(ClockCacheTest, MigrationSinkDefersPromotion) {
+    std::vector<string> requested;
+    clockCache->setMigrationSink([&requested](std::string_view key) {
+        requested.emplace_back(key);
+        return true;
+    });
+    clockCache->nvm_list.insertNode("nvmKey", "value1");
+    indexNode(clockCache->nvm_list.head);
+
+    // 第二次寫入後達到Pre_Migration，只送出請求，不在put()裡遷移
+    clockCache->put("nvmKey", "value2");
+    clockCache->put("nvmKey", "value3");
+    ASSERT_EQ(requested.size(), 1);
+    EXPECT_EQ(requested[0], "nvmKey");
+    EXPECT_TRUE(clockCache->findNvm("nvmKey") != nullptr);
+
+    EXPECT_TRUE(clockCache->migrate("nvmKey"));
+    EXPECT_TRUE(clockCache->findDram("nvmKey") != nullptr);
+    EXPECT_TRUE(clockCache->findNvm("nvmKey") == nullptr);
+    // 已經遷移過或不存在的key直接忽略
+    EXPECT_FALSE(clockCache->migrate("nvmKey"));
+    EXPECT_FALSE(clockCache->migrate("missingKey"));
+}
 
+TEST_F(ClockCacheTest, BackgroundEvictionHonorsWatermarks) {
+    int notified = 0;
+    clockCache->setEvictionWatermarks(0.5, 0.75, [&notified] { notified++; });
+    int i = 0;
+    while (notified == 0) {
+        clockCache->put("fillKey" + std::to_string(i++), "fillValue");
+    }
+    EXPECT_GT(clockCache->dram_list.currentSize, clockCache->dramCapacity * 3 / 4);
+    EXPECT_EQ(clockCache->evictionStats().foregroundDram, 0);
+
+    EXPECT_TRUE(clockCache->backgroundEvict(1000));
+    EXPECT_LE(clockCache->dram_list.currentSize, clockCache->dramCapacity / 2);
+    ClockCache::EvictionStats stats = clockCache->evictionStats();
+    EXPECT_GT(stats.backgroundDram, 0);
+    EXPECT_EQ(stats.foregroundDram, 0);
+
+    // 每次最多逐出maxNodes個
+    while (clockCache->dram_list.currentSize <= clockCache->dramCapacity * 3 / 4) {
+        clockCache->put("fillKey" + std::to_string(i++), "fillValue");
+    }
+    EXPECT_FALSE(clockCache->backgroundEvict(1));
+    EXPECT_EQ(clockCache->evictionStats().backgroundDram, stats.backgroundDram + 1);
 
+    // 沒有背景逐出時寫滿就在前景逐出
+    for (int j = 0; j < 50; ++j) {
+        clockCache->put("fillKey" + std::to_string(i++), "fillValue");
+    }
+    EXPECT_GT(clockCache->evictionStats().foregroundDram, 0);
+}
 
+// 設定shadow預算後，NVM中的小value不能讓shadow佔用的DRAM無限制地增加
+TEST_F(ClockCacheTest, NvmShadowBudgetEvictsNvmEntries) {
+    size_t perEntry = NvmCircularLinkedList::shadowFootprint(strlen("smallKey0"));
+    clockCache->setLoadTier(LoadTier::Nvm);
+    clockCache->setNvmShadowBudget(4 * perEntry);
+    for (int i = 0; i < 10; i++) {
+        EXPECT_TRUE(clockCache->insertLoaded("smallKey" + std::to_string(i), "v"));
+        EXPECT_LE(clockCache->nvmShadowBytes(), 4 * perEntry);
+    }
+    // NVM容量放得下全部10個，逐出都是shadow預算造成的
+    EXPECT_LT(10 * NvmCircularLinkedList::nodeSize(strlen("smallKey0"), 1), clockCache->nvmCapacity);
+    EXPECT_EQ(clockCache->evictionStats().foregroundNvm, 6);
+    EXPECT_TRUE(clockCache->findNvm("smallKey9") != nullptr);
+
+    // shadow超過high水位時通知背景逐出，背景逐出降到low水位
+    int notified = 0;
+    clockCache->setEvictionWatermarks(0.5, 0.75, [&notified] { notified++; });
+    EXPECT_TRUE(clockCache->insertLoaded("smallKeyA", "v"));
+    EXPECT_GT(notified, 0);
+    EXPECT_TRUE(clockCache->backgroundEvict(16));
+    EXPECT_LE(clockCache->nvmShadowBytes(), 2 * perEntry);
+    EXPECT_GT(clockCache->evictionStats().backgroundNvm, 0);
+
+    // 縮小預算時超過的部分立即逐出
+    clockCache->setNvmShadowBudget(perEntry);
+    EXPECT_LE(clockCache->nvmShadowBytes(), perEntry);
+}
 
+TEST_F(ClockCacheTest, DemoteDramVictimsToNvm) {
+    clockCache->enableDemotion();
+    for (int i = 0; i < 30; ++i) {
+        clockCache->put("demoteKey" + std::to_string(i), "demoteValue" + std::to_string(i));
+    }
+    EXPECT_LE(clockCache->dram_list.currentSize, clockCache->dramCapacity);
+    EXPECT_LE(clockCache->nvm_list.currentSize, clockCache->nvmCapacity);
+    EXPECT_GT(clockCache->evictionStats().demoted, 0);
+
+    // 最早寫入的key被逐出DRAM後仍然可以從NVM讀到
+    NvmNode* demoted = clockCache->findNvm("demoteKey0");
+    ASSERT_TRUE(demoted != nullptr);
+    EXPECT_TRUE(clockCache->findDram("demoteKey0") == nullptr);
+    EXPECT_EQ(demoted->attributes.status, NvmNode::Initial);
+    string value;
+    EXPECT_TRUE(clockCache->get("demoteKey0", &value));
+    EXPECT_EQ(value, "demoteValue0");
+}
 
+TEST_F(ClockCacheTest, DemotionFiltersByReadStatus) {
+    clockCache->enableDemotion(DramNode::Once_read);
+    clockCache->put("readKey", "readValue");
+    clockCache->put("coldKey", "coldValue");
+    string value;
+    EXPECT_TRUE(clockCache->get("readKey", &value));
 
+    // 兩個節點都被逐出：讀過的降級，沒讀過的直接丟棄
+    clockCache->setMaxEvictionScan(1);
+    for (int i = 0; i < 30; ++i) {
+        clockCache->put("fillKey" + std::to_string(i), "fillValue");
+    }
+    ASSERT_TRUE(clockCache->findDram("readKey") == nullptr);
+    ASSERT_TRUE(clockCache->findDram("coldKey") == nullptr);
+    EXPECT_TRUE(clockCache->findNvm("readKey") != nullptr);
+    EXPECT_TRUE(clockCache->findNvm("coldKey") == nullptr);
+    EXPECT_FALSE(clockCache->get("coldKey", &value));
+}
+
+TEST_F(ClockCacheTest, BinaryKeysAndValuesSurviveTierTransfer) {
+    string dramKey("dram\0key", 8);
+    string dramValue("\0dram\0value\0", 13);
+    string nvmKey("nvm\0key", 7);
+    string nvmValue("nvm\0value", 9);
+    string value;
+
+    // 只差在'\0'之後的key是不同的key
+    clockCache->put(dramKey, dramValue);
+    clockCache->put(string("dram\0other", 10), "other");
+    EXPECT_TRUE(clockCache->get(dramKey, &value));
+    EXPECT_EQ(value, dramValue);
+
+    NvmNode* nvmNode = clockCache->nvm_list.insertNode(nvmKey, nvmValue);
+    indexNode(nvmNode);
+    EXPECT_TRUE(clockCache->get(nvmKey, &value));
+    EXPECT_EQ(value, nvmValue);
+
+    // 交換時整段payload直接複製，長度與內容都不變
+    DramNode* dramNode = clockCache->findDram(dramKey);
+    ASSERT_TRUE(dramNode != nullptr);
+    clockCache->swapNodes(nvmNode, dramNode);
+    ASSERT_TRUE(clockCache->findDram(nvmKey) != nullptr);
+    ASSERT_TRUE(clockCache->findNvm(dramKey) != nullptr);
+    EXPECT_EQ(clockCache->findDram(nvmKey)->dataView(), nvmValue);
+    EXPECT_EQ(clockCache->findNvm(dramKey)->dataView(), dramValue);
+
+    EXPECT_TRUE(clockCache->get(dramKey, &value));
+    EXPECT_EQ(value, dramValue);
+    EXPECT_TRUE(clockCache->get(nvmKey, &value));
+    EXPECT_EQ(value, nvmValue);
+    EXPECT_TRUE(clockCache->get(string("dram\0other", 10), &value));
+    EXPECT_EQ(value, "other");
+}
+
+// 重新開啟pool後，NVM中的資料可以用recover()找回，DRAM中的資料則不保留
+TEST_F(ClockCacheTest, RecoverNvmTierAfterRestart) {
+    delete clockCache;
+    clockCache = new ClockCache(pm, 1024, 2048);
+    clockCache->recover();
+    while (clockCache->evictNvmNode()) {}
+
+    string binaryKey("nvm\0key", 7);
+    string binaryValue("binary\0value", 12);
+    clockCache->put("dramKey", "dramValue");
+    indexNode(clockCache->nvm_list.insertNode("nvmKey", "nvmValue"));
+    indexNode(clockCache->nvm_list.insertNode(binaryKey, binaryValue));
+    clockCache->put("nvmKey", "newValue"); // 原地覆寫的值也要保留
+
+    delete clockCache;
+    delete pm;
+    pm = new PMmanager("ClockRWRFCacheTest");
+    clockCache = new ClockCache(pm, 1024, 2048);
+    EXPECT_EQ(clockCache->recover(), 2);
+
+    NvmNode* node = clockCache->findNvm("nvmKey");
+    ASSERT_TRUE(node != nullptr);
+    EXPECT_EQ(node->dataView(), "newValue");
+    EXPECT_EQ(node->attributes.status, NvmNode::Initial);
+    EXPECT_EQ(clockCache->nvm_list.currentSize,
+              NvmCircularLinkedList::nodeSize(6, 8) + NvmCircularLinkedList::nodeSize(7, 12));
+    string value;
+    EXPECT_TRUE(clockCache->get(binaryKey, &value));
+    EXPECT_EQ(value, binaryValue);
+    EXPECT_FALSE(clockCache->get("dramKey", &value));
+
+    // 找回的節點和新寫入的節點一樣可以被逐出
+    while (clockCache->evictNvmNode()) {}
+    EXPECT_EQ(clockCache->nvm_list.currentSize, 0);
+}
+
+// checksum不符、等待回收的節點不會被找回，同一個key有兩個節點時保留較新的
+TEST_F(ClockCacheTest, RecoverDiscardsTornAndStaleNodes) {
+    delete clockCache;
+    clockCache = new ClockCache(pm, 1024, 2048);
+    clockCache->recover();
+    while (clockCache->evictNvmNode()) {}
+
+    NvmNode* torn = clockCache->nvm_list.insertNode("tornKey", "tornValue");
+    indexNode(torn);
+    torn->data[0] = 'X'; // 覆寫到一半時crash：value已經改了，checksum還是舊的
+    NvmNode* retired = clockCache->nvm_list.insertNode("retiredKey", "retiredValue");
+    clockCache->nvm_list.unlinkNode(retired);
+    clockCache->nvm_list.insertNode("dupKey", "oldValue");
+    indexNode(clockCache->nvm_list.insertNode("dupKey", "newValue"));
+
+    delete clockCache;
+    delete pm;
+    pm = new PMmanager("ClockRWRFCacheTest");
+    clockCache = new ClockCache(pm, 1024, 2048);
+    clockCache->recover();
+
+    EXPECT_TRUE(clockCache->findNvm("tornKey") == nullptr);
+    EXPECT_TRUE(clockCache->findNvm("retiredKey") == nullptr);
+    NvmNode* node = clockCache->findNvm("dupKey");
+    ASSERT_TRUE(node != nullptr);
+    EXPECT_EQ(node->dataView(), "newValue");
+    EXPECT_EQ(clockCache->nvm_list.currentSize, NvmCircularLinkedList::nodeSize(6, 8));
+
+    while (clockCache->evictNvmNode()) {}
+}
+
+// compaction把live比例低的segment中仍在使用的record搬到新的segment，索引改指向新節點
+TEST_F(ClockCacheTest, CompactNvmRelocatesLiveRecords) {
+    // 每個segment放得下4個record
+    size_t recordSpan = NvmCircularLinkedList::recordSpan(NvmCircularLinkedList::nodeSize(5, 7));
+    int notifications = 0;
+    clockCache->enableLogStructuredNvm(NvmCircularLinkedList::kSegmentHeaderSize + 4 * recordSpan, 0.5,
+                                       [&notifications] { notifications++; });
+    for (int i = 0; i < 12; i++) {
+        indexNode(clockCache->nvm_list.insertNode("key" + std::to_string(i), "value" + std::to_string(i)));
+    }
+    ASSERT_EQ(clockCache->nvm_list.segments.size(), 3);
+    NvmSegment* first = clockCache->findNvm("key3")->segment;
+    NvmSegment* second = clockCache->findNvm("key7")->segment;
+    for (int i : {0, 1, 2, 4, 5}) {
+        clockCache->eraseNvmNode(clockCache->findNvm("key" + std::to_string(i)));
+    }
+    clockCache->findNvm("key3")->attributes.status = NvmNode::Be_Written;
+    EXPECT_TRUE(clockCache->needsNvmCompaction());
+    EXPECT_GT(notifications, 0);
+    // 被刪除的record在segment被壓縮前仍然佔用NVM容量
+    EXPECT_GT(clockCache->nvm_list.usedBytes(), clockCache->nvm_list.currentSize);
+
+    size_t sizeBefore = clockCache->nvm_list.currentSize;
+    size_t usedBefore = clockCache->nvm_list.usedBytes();
+    int notificationsBefore = notifications;
+    EXPECT_EQ(clockCache->compactNvm(4), 2);
+    EXPECT_FALSE(clockCache->needsNvmCompaction());
+    EXPECT_EQ(clockCache->nvmCompactionCount(), 2);
+    EXPECT_EQ(clockCache->nvm_list.currentSize, sizeBefore);
+    EXPECT_LT(clockCache->nvm_list.usedBytes(), usedBefore);
+    // 搬移record時的刪除不會再要求compaction
+    EXPECT_EQ(notifications, notificationsBefore);
+    for (NvmSegment* segment : clockCache->nvm_list.segments) {
+        EXPECT_NE(segment, first);
+        EXPECT_NE(segment, second);
+    }
+    for (int i : {3, 6, 7, 8, 9, 10, 11}) {
+        NvmNode* node = clockCache->findNvm("key" + std::to_string(i));
+        ASSERT_TRUE(node != nullptr);
+        EXPECT_EQ(node->dataView(), "value" + std::to_string(i));
+    }
+    EXPECT_EQ(clockCache->findNvm("key3")->attributes.status, NvmNode::Be_Written);
+    EXPECT_EQ(clockCache->findNvm("key3")->segment, clockCache->findNvm("key7")->segment);
+}
 
+// NVM節點的連結、狀態與key都在DRAM，讀取命中和clock掃描不會改到NVM中的record
+TEST_F(ClockCacheTest, NvmReadsAndSweepsLeaveRecordsUntouched) {
+    NvmNode* first = clockCache->nvm_list.insertNode("firstKey", "firstValue");
+    indexNode(first);
+    NvmNode* second = clockCache->nvm_list.insertNode("secondKey", "secondValue");
+    indexNode(second);
+    EXPECT_NE(static_cast<void*>(first->key), static_cast<void*>(first->record->payload()));
+    EXPECT_EQ(first->data, first->record->payload() + strlen("firstKey") + 1);
+    // shadow佔用DRAM，但不計入任何tier的容量
+    EXPECT_EQ(clockCache->nvmShadowBytes(),
+              DramArena::classSize(NvmCircularLinkedList::shadowSize(strlen("firstKey"))) +
+              DramArena::classSize(NvmCircularLinkedList::shadowSize(strlen("secondKey"))));
+    EXPECT_EQ(clockCache->dram_list.currentSize, 0);
 
+    string value;
+    for (int i = 0; i < 2; i++) {
+        EXPECT_TRUE(clockCache->get("firstKey", &value));
+        EXPECT_TRUE(clockCache->get("secondKey", &value));
+    }
+    string before(reinterpret_cast<const char*>(second->record), second->record->size);
+    EXPECT_TRUE(clockCache->evictNvmNode());
+    ASSERT_TRUE(clockCache->findNvm("secondKey") == second);
+    EXPECT_EQ(second->attributes.reference, 0);
+    EXPECT_EQ(string(reinterpret_cast<const char*>(second->record), second->record->size), before);
+    EXPECT_EQ(second->record->checksum, second->record->computeChecksum());
+}
+
+TEST_F(ClockCacheTest, GetOrLoadPlacesValueByLoadTier) {
+    int loads = 0;
+    ClockCache::Loader loader = [&loads](std::string_view key, string* value) {
+        loads++;
+        if (key == "missingKey") return false;
+        value->assign("loaded_" + std::string(key));
+        return true;
+    };
+
+    string value;
+    EXPECT_TRUE(clockCache->getOrLoad("dramKey", &value, loader));
+    EXPECT_EQ(value, "loaded_dramKey");
+    EXPECT_TRUE(clockCache->findDram("dramKey") != nullptr);
+
+    clockCache->setLoadTier(LoadTier::Nvm);
+    EXPECT_TRUE(clockCache->getOrLoad("nvmKey", &value, loader));
+    EXPECT_EQ(value, "loaded_nvmKey");
+    NvmNode* nvmNode = clockCache->findNvm("nvmKey");
+    ASSERT_TRUE(nvmNode != nullptr);
+    EXPECT_EQ(nvmNode->attributes.status, NvmNode::Initial);
+
+    // 已在cache中的key不再呼叫loader；來源沒有的key不會被放入
+    EXPECT_TRUE(clockCache->getOrLoad("nvmKey", &value, loader));
+    EXPECT_FALSE(clockCache->getOrLoad("missingKey", &value, loader));
+    EXPECT_EQ(loads, 3);
+    EXPECT_TRUE(clockCache->findDram("missingKey") == nullptr && clockCache->findNvm("missingKey") == nullptr);
+
+    // load期間被put的值比來源新，不會被覆蓋
+    clockCache->put("racedKey", "written");
+    EXPECT_FALSE(clockCache->insertLoaded("racedKey", "stale"));
+    EXPECT_TRUE(clockCache->get("racedKey", &value));
+    EXPECT_EQ(value, "written");
+}
+
+TEST_F(ClockCacheTest, AdmissionFilterKeepsHotSetAgainstScan) {
+    clockCache->enableAdmissionFilter(64);
+    size_t nodeSize = DramCircularLinkedList::nodeSize(strlen("hotKey0"), strlen("hotValue0"));
+    int hotCount = static_cast<int>(clockCache->dramCapacity / nodeSize);
+    string value;
+    for (int i = 0; i < hotCount; i++) {
+        clockCache->put("hotKey" + std::to_string(i), "hotValue" + std::to_string(i));
+        for (int r = 0; r < 3; r++) {
+            clockCache->get("hotKey" + std::to_string(i), &value);
+        }
+    }
+
+    // 只寫一次的key估計頻率比hot key低，DRAM滿了之後改放NVM
+    for (int i = 0; i < 20; i++) {
+        clockCache->put("scanKey" + std::to_string(i), "scanValue" + std::to_string(i));
+    }
+    EXPECT_EQ(clockCache->admissionRejectionCount(), 20);
+    for (int i = 0; i < hotCount; i++) {
+        EXPECT_TRUE(clockCache->findDram("hotKey" + std::to_string(i)) != nullptr);
+    }
+    EXPECT_TRUE(clockCache->findNvm("scanKey19") != nullptr);
+
+    // 寫入前已經被讀過多次的新key比victim熱，可以進DRAM
+    for (int r = 0; r < 6; r++) {
+        EXPECT_FALSE(clockCache->get("popularKey", &value));
+    }
+    clockCache->put("popularKey", "popularValue");
+    EXPECT_TRUE(clockCache->findDram("popularKey") != nullptr);
+    EXPECT_EQ(clockCache->admissionRejectionCount(), 20);
+
+    // multiGet沒有命中的key同樣計入頻率
+    std::vector<std::string_view> batch = {"batchKey"};
+    std::vector<string> batchValues;
+    std::vector<bool> found;
+    for (int r = 0; r < 6; r++) {
+        EXPECT_EQ(clockCache->multiGet(batch, &batchValues, &found), 0);
+    }
+    clockCache->put("batchKey", "batchValue");
+    EXPECT_TRUE(clockCache->findDram("batchKey") != nullptr);
+    EXPECT_EQ(clockCache->admissionRejectionCount(), 20);
+
+    // 計數器上限為15，老化時減半
+    FrequencySketch sketch(16);
+    for (int i = 0; i < 20; i++) {
+        sketch.increment(42);
+    }
+    EXPECT_EQ(sketch.frequency(42), FrequencySketch::kMaxCount);
+    sketch.reset();
+    EXPECT_EQ(sketch.frequency(42), FrequencySketch::kMaxCount / 2);
+}
+
+TEST_F(ClockCacheTest, GhostHitsShiftCapacityBetweenTiers) {
+    size_t total = clockCache->dramCapacity + clockCache->nvmCapacity;
+    clockCache->enableAdaptiveSplit(512, 1024 + 128, 128, 64);
+    EXPECT_EQ(clockCache->dramBudget(), 1024);
+
+    // 寫入超過DRAM容量，最早的key被逐出並留在DRAM的ghost list
+    for (int i = 0; i < 20; i++) {
+        clockCache->put("key" + std::to_string(i), "value" + std::to_string(i));
+    }
+    ASSERT_TRUE(clockCache->findDram("key0") == nullptr);
+    ASSERT_TRUE(clockCache->findDram("key1") == nullptr);
+    string value;
+    EXPECT_FALSE(clockCache->get("key0", &value));
+    EXPECT_EQ(clockCache->dramBudget(), 1024 + 128);
+    EXPECT_EQ(clockCache->dramBudget() + clockCache->nvmBudget(), total);
+    EXPECT_EQ(clockCache->splitAdaptationCount(), 1);
+    // 已經到maxDram，再命中也不再移動；同一個ghost只會命中一次
+    EXPECT_FALSE(clockCache->get("key1", &value));
+    EXPECT_FALSE(clockCache->get("key0", &value));
+    EXPECT_EQ(clockCache->dramBudget(), 1024 + 128);
+    EXPECT_EQ(clockCache->splitAdaptationCount(), 1);
+
+    // NVM逐出的key再次出現時容量移回NVM
+    indexNode(clockCache->nvm_list.insertNode("nvmKey", "nvmValue"));
+    ASSERT_TRUE(clockCache->evictNvmNode());
+    clockCache->put("nvmKey", "nvmValue");
+    EXPECT_LT(clockCache->dramBudget(), 1024 + 128);
+    EXPECT_GE(clockCache->dramBudget(), 512);
+    EXPECT_EQ(clockCache->dramBudget() + clockCache->nvmBudget(), total);
+    EXPECT_LE(clockCache->dram_list.currentSize, clockCache->dramBudget());
+    EXPECT_EQ(clockCache->splitAdaptationCount(), 2);
+
+    // multiGet沒有命中的key也檢查ghost list
+    size_t dramBefore = clockCache->dramBudget();
+    ASSERT_TRUE(clockCache->findDram("key2") == nullptr);
+    std::vector<std::string_view> batch = {"key2"};
+    std::vector<string> values;
+    std::vector<bool> found;
+    EXPECT_EQ(clockCache->multiGet(batch, &values, &found), 0);
+    EXPECT_GT(clockCache->dramBudget(), dramBefore);
+    EXPECT_EQ(clockCache->splitAdaptationCount(), 3);
+}
+
+TEST_F(ClockCacheTest, ExpiredEntriesAreMissesAndReclaimedByWheel) {
+    uint64_t now = 1000000;
+    clockCache->setClock([&now] { return now; });
+    clockCache->put("shortKey", "shortValue", 100);
+    clockCache->put("longKey", "longValue", 60000);
+    clockCache->put("plainKey", "plainValue");
+    indexNode(clockCache->nvm_list.insertNode("nvmKey", "nvmValue"));
+    clockCache->put("nvmKey", "newValue", 500); // 原地覆寫時TTL也寫入NVM record
+    EXPECT_EQ(clockCache->findNvm("nvmKey")->record->expiresAt, now + 500);
+
+    string value;
+    now += 50;
+    EXPECT_TRUE(clockCache->get("shortKey", &value));
+    now += 100;
+    EXPECT_FALSE(clockCache->get("shortKey", &value));
+    EXPECT_TRUE(clockCache->findDram("shortKey") == nullptr);
+    EXPECT_EQ(clockCache->expirationCount(), 1);
+
+    // 沒有被讀取的過期節點由timing wheel移除
+    now += 2000;
+    EXPECT_EQ(clockCache->expireEntries(16), 1);
+    EXPECT_TRUE(clockCache->findNvm("nvmKey") == nullptr);
+    EXPECT_EQ(clockCache->nvm_list.currentSize, 0);
+    EXPECT_TRUE(clockCache->get("longKey", &value));
+    EXPECT_TRUE(clockCache->get("plainKey", &value));
+
+    // 每次最多移除maxEntries個
+    for (int i = 0; i < 6; i++) {
+        clockCache->put("batchKey" + std::to_string(i), "batchValue", 100);
+    }
+    now += 1500;
+    EXPECT_EQ(clockCache->expireEntries(4), 4);
+    EXPECT_EQ(clockCache->expireEntries(16), 2);
+    EXPECT_EQ(clockCache->expireEntries(16), 0);
+    EXPECT_EQ(clockCache->expirationCount(), 8);
+    EXPECT_TRUE(clockCache->findDram("longKey") != nullptr);
+
+    // clock掃描遇到過期的節點時不看reference直接逐出
+    clockCache->put("staleKey", "staleValue", 100);
+    clockCache->put("freshKey", "freshValue");
+    now += 200;
+    clockCache->dram_list.hand = clockCache->findDram("longKey");
+    EXPECT_TRUE(clockCache->evictDramNode());
+    EXPECT_TRUE(clockCache->findDram("staleKey") == nullptr);
+    EXPECT_TRUE(clockCache->findDram("freshKey") != nullptr);
+    EXPECT_TRUE(clockCache->findDram("plainKey") != nullptr);
+
+    // 放在上層的entry輪到時往下層分配，超過wheel範圍的entry到時重新排程
+    const uint64_t kDay = 24ULL * 3600 * 1000;
+    clockCache->put("farKey", "farValue", 400 * kDay);
+    now += 60000;
+    EXPECT_EQ(clockCache->expireEntries(16), 1);
+    EXPECT_TRUE(clockCache->findDram("longKey") == nullptr);
+    now += 300 * kDay;
+    EXPECT_EQ(clockCache->expireEntries(16), 0);
+    EXPECT_TRUE(clockCache->get("farKey", &value));
+    now += 100 * kDay;
+    EXPECT_EQ(clockCache->expireEntries(16), 1);
+    EXPECT_TRUE(clockCache->findDram("farKey") == nullptr);
+
+    // multiGet讀到過期的節點時移除，同一批中重複的key只移除一次
+    clockCache->put("multiKey", "multiValue", 100);
+    now += 200;
+    std::vector<std::string_view> keys = {"multiKey", "plainKey", "multiKey"};
+    std::vector<string> values;
+    std::vector<bool> found;
+    uint64_t expiredBefore = clockCache->expirationCount();
+    EXPECT_EQ(clockCache->multiGet(keys, &values, &found), 1);
+    EXPECT_FALSE(found[0]);
+    EXPECT_TRUE(found[1]);
+    EXPECT_FALSE(found[2]);
+    EXPECT_TRUE(clockCache->findDram("multiKey") == nullptr);
+    EXPECT_EQ(clockCache->expirationCount(), expiredBefore + 1);
+}
+
+// TTL跟著節點在tier之間搬移，NVM record中的過期時間在暖啟動後仍然有效
+TEST_F(ClockCacheTest, TtlFollowsEntriesAcrossTiersAndRestart) {
+    delete clockCache;
+    clockCache = new ClockCache(pm, 1024, 2048);
+    clockCache->recover();
+    while (clockCache->evictNvmNode()) {}
+    uint64_t now = 1000000;
+    clockCache->setClock([&now] { return now; });
+
+    clockCache->put("ttlKey", "ttlValue", 5000);
+    clockCache->demoteToNvm(clockCache->findDram("ttlKey"));
+    NvmNode* node = clockCache->findNvm("ttlKey");
+    ASSERT_TRUE(node != nullptr);
+    EXPECT_EQ(node->expiresAt, now + 5000);
+    EXPECT_EQ(node->record->expiresAt, now + 5000);
+    ASSERT_TRUE(node->timer != nullptr);
+    EXPECT_EQ(KeyIndex::nvmNode(node->timer->node), node);
+    indexNode(clockCache->nvm_list.insertNode("shortKey", "shortValue", now + 100));
+
+    delete clockCache;
+    delete pm;
+    pm = new PMmanager("ClockRWRFCacheTest");
+    clockCache = new ClockCache(pm, 1024, 2048);
+    clockCache->setClock([&now] { return now; });
+    now += 1000;
+    // 停機期間過期的record不會被找回
+    EXPECT_EQ(clockCache->recover(), 1);
+    EXPECT_TRUE(clockCache->findNvm("shortKey") == nullptr);
+    node = clockCache->findNvm("ttlKey");
+    ASSERT_TRUE(node != nullptr);
+    EXPECT_TRUE(node->timer != nullptr);
+    now += 5000;
+    EXPECT_EQ(clockCache->expireEntries(16), 1);
+    EXPECT_EQ(clockCache->nvm_list.currentSize, 0);
+}
+
+// value的大小分布改變時，舊size class的slab清空後還給系統，arena向系統要的記憶體不會一直累積
+TEST_F(ClockCacheTest, ArenaReturnsSlabsWhenValueSizesShift) {
+    delete clockCache;
+    const size_t dramSize = 4 * DramArena::kSlabSize;
+    clockCache = new ClockCache(pm, dramSize, 2048);
+    const size_t valueSizes[] = {40, 200, 900, 3000};
+    for (int round = 0; round < 3; ++round) {
+        for (size_t valueSize : valueSizes) {
+            // 寫入兩倍容量的新key，上一個size class的節點全部被逐出
+            string value(valueSize, 'v');
+            size_t keyCount = 2 * dramSize / DramCircularLinkedList::nodeSize(8, valueSize);
+            for (size_t i = 0; i < keyCount; ++i) {
+                clockCache->put("s" + std::to_string(valueSize) + "_" + std::to_string(i), value);
+            }
+            EXPECT_LE(clockCache->dram_list.currentSize, dramSize);
+            // 最多多出目前class未填滿的slab和保留的一個空slab
+            EXPECT_LE(clockCache->dram_list.arena.reservedBytes(), dramSize + 2 * DramArena::kSlabSize);
+        }
+    }
+}
+
+// log-structured時sealed segment中的dead bytes計入NVM容量，放不下時先壓縮segment
+TEST_F(ClockCacheTest, LogStructuredNvmChargesDeadBytes) {
+    size_t segmentSize = NvmCircularLinkedList::kSegmentHeaderSize +
+                         4 * NvmCircularLinkedList::recordSpan(NvmCircularLinkedList::nodeSize(4, 100));
+    clockCache->enableLogStructuredNvm(segmentSize, 0.5);
+    clockCache->setLoadTier(LoadTier::Nvm);
+    // 寫入的key留在NVM，不遷移到DRAM
+    clockCache->setMigrationSink([](std::string_view) { return false; });
+    for (int i = 0; i < 3; i++) {
+        clockCache->insertLoaded("hot" + std::to_string(i), string(100, 'a'));
+    }
+    // 每個segment都留下一個cold record，其餘是之後被覆寫掉的hot record
+    string latest;
+    for (int round = 0; round < 40; round++) {
+        clockCache->insertLoaded("cold" + std::to_string(round), "c");
+        // value在1和100 bytes之間交替，每次覆寫都放不進原本的record
+        latest.assign(round % 2 == 0 ? 1 : 100, static_cast<char>('a' + round % 26));
+        for (int i = 0; i < 3; i++) {
+            clockCache->put("hot" + std::to_string(i), latest);
+            EXPECT_LE(clockCache->nvm_list.usedBytes(), clockCache->nvmCapacity);
+        }
+    }
+    EXPECT_GT(clockCache->nvmCompactionCount(), 0);
+    EXPECT_LE(clockCache->nvm_list.segments.size(), clockCache->nvmCapacity / segmentSize + 1);
+    string value;
+    for (int i = 0; i < 3; i++) {
+        EXPECT_TRUE(clockCache->get("hot" + std::to_string(i), &value));
+        EXPECT_EQ(value, latest);
+    }
+}
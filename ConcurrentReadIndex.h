@@ -0,0 +1,69 @@
+#ifndef CONCURRENT_READ_INDEX_H
+#define CONCURRENT_READ_INDEX_H
+
+#include <atomic>
+#include <cstdint>
+#include <memory>
+
+// 給無鎖讀取用的lookaside索引(有損)
+// 只有持有shard鎖的寫者會修改，讀者在EpochManager::Guard保護下不加鎖查詢。
+// 每個hash只探測固定長度的窗口，窗口滿了就不放入，讀者找不到時退回加鎖的路徑。
+// 每個slot存放節點指標，最低位元標記NVM節點。
+class ConcurrentReadIndex {
+public:
+    static const size_t kProbeWindow = 8;
+    static const uintptr_t kNvmTag = 1;
+
+    explicit ConcurrentReadIndex(size_t capacity) {
+        size_t slotCount = kProbeWindow;
+        while (slotCount < capacity) slotCount <<= 1;
+        mask = slotCount - 1;
+        slots.reset(new std::atomic<uintptr_t>[slotCount]);
+        for (size_t i = 0; i < slotCount; i++) {
+            slots[i].store(0, std::memory_order_relaxed);
+        }
+    }
+
+    // 讀者：回傳窗口中第i個slot的內容(i < kProbeWindow)，空的slot回傳0，呼叫者要跳過
+    uintptr_t load(uint64_t hash, size_t i) const {
+        return slots[(hash + i) & mask].load(std::memory_order_acquire);
+    }
+
+    // 寫者：放入節點，窗口已滿則放棄
+    bool publish(uint64_t hash, uintptr_t tagged) {
+        size_t freeSlot = kProbeWindow;
+        for (size_t i = 0; i < kProbeWindow; i++) {
+            uintptr_t current = slots[(hash + i) & mask].load(std::memory_order_relaxed);
+            if (current == tagged) return true;
+            if (current == 0 && freeSlot == kProbeWindow) freeSlot = i;
+        }
+        if (freeSlot == kProbeWindow) return false;
+        slots[(hash + freeSlot) & mask].store(tagged, std::memory_order_release);
+        return true;
+    }
+
+    // 持鎖者：確認節點仍在索引中(也就是尚未被retire)
+    bool contains(uint64_t hash, uintptr_t tagged) const {
+        for (size_t i = 0; i < kProbeWindow; i++) {
+            if (slots[(hash + i) & mask].load(std::memory_order_relaxed) == tagged) return true;
+        }
+        return false;
+    }
+
+    // 寫者：在節點被retire之前移除
+    void unpublish(uint64_t hash, uintptr_t tagged) {
+        for (size_t i = 0; i < kProbeWindow; i++) {
+            std::atomic<uintptr_t>& slot = slots[(hash + i) & mask];
+            if (slot.load(std::memory_order_relaxed) == tagged) {
+                slot.store(0, std::memory_order_seq_cst);
+                return;
+            }
+        }
+    }
+
+private:
+    std::unique_ptr<std::atomic<uintptr_t>[]> slots;
+    size_t mask;
+};
+
+#endif // CONCURRENT_READ_INDEX_H
@@ -0,0 +1,183 @@
+#ifndef DRAM_ARENA_H
+#define DRAM_ARENA_H
+
+#include <cstddef>
+#include <cstdint>
+#include <new>
+#include <unordered_map>
+#include <vector>
+
+// DRAM節點用的size-class slab配置器
+// 每個size class從64KB的slab切出固定大小的chunk，釋放的chunk放回所屬slab的free list重用。
+// slab中的chunk全部釋放後就還給系統(最多留一個空的64KB slab給下一次refill)，
+// value的大小分布改變時，不再使用的size class不會一直佔著slab。
+// 大於kMaxClassSize的請求直接向系統配置，大小以4KB為單位取整。
+// classSize()就是一個請求實際佔用的bytes，DRAM容量以它計算；slab中還沒配置出去的chunk只算在reservedBytes()。
+// 不是thread-safe，由擁有它的DramCircularLinkedList的呼叫者串行化。
+class DramArena {
+public:
+    static constexpr size_t kMaxClassSize = 32 * 1024;
+    static constexpr size_t kSlabSize = 64 * 1024;
+    static constexpr size_t kPageSize = 4096;
+
+    DramArena() : partial(kClassCount, nullptr), spare(nullptr), reserved(0) {}
+
+    DramArena(const DramArena&) = delete;
+    DramArena& operator=(const DramArena&) = delete;
+
+    ~DramArena() {
+        for (Slab* slab : slabs) {
+            ::operator delete(slab->base, std::align_val_t(kSlabSize));
+            delete slab;
+        }
+    }
+
+    // 請求bytes實際佔用的大小：128以下以16 bytes為級距，之後每個2的冪次區間分4級
+    static size_t classSize(size_t bytes) {
+        if (bytes > kMaxClassSize) return (bytes + kPageSize - 1) / kPageSize * kPageSize;
+        return sizeOfClass(classIndex(bytes));
+    }
+
+    void* allocate(size_t bytes) {
+        if (bytes > kMaxClassSize) {
+            reserved += classSize(bytes);
+            return ::operator new(classSize(bytes));
+        }
+        size_t index = classIndex(bytes);
+        Slab* slab = partial[index];
+        if (slab == nullptr) {
+            slab = refill(index);
+        }
+        FreeChunk* chunk = slab->freeChunks;
+        slab->freeChunks = chunk->next;
+        slab->live++;
+        if (slab->freeChunks == nullptr) unlinkPartial(slab);
+        return chunk;
+    }
+
+    // bytes可以是allocate()時的請求大小或它的classSize()
+    void deallocate(void* ptr, size_t bytes) {
+        if (bytes > kMaxClassSize) {
+            reserved -= classSize(bytes);
+            ::operator delete(ptr);
+            return;
+        }
+        Slab* slab = pages.find(reinterpret_cast<uintptr_t>(ptr) / kSlabSize)->second;
+        if (slab->freeChunks == nullptr) linkPartial(slab);
+        FreeChunk* chunk = static_cast<FreeChunk*>(ptr);
+        chunk->next = slab->freeChunks;
+        slab->freeChunks = chunk;
+        if (--slab->live == 0) releaseSlab(slab);
+    }
+
+    // 目前向系統要的總大小(slab加上大型配置)
+    size_t reservedBytes() const { return reserved; }
+
+private:
+    struct FreeChunk {
+        FreeChunk* next;
+    };
+
+    // slab以kSlabSize對齊、大小是kSlabSize的倍數，chunk所在的slab由位址查pages得到
+    struct Slab {
+        char* base;
+        size_t bytes;
+        size_t classIndex;
+        size_t live;           // 已配置出去的chunk數
+        FreeChunk* freeChunks;
+        Slab* prevPartial;     // 同一個class還有空chunk的slab
+        Slab* nextPartial;
+        size_t index;          // 在slabs中的位置
+    };
+
+    static constexpr size_t kClassCount = 40;
+
+    std::vector<Slab*> partial;  // 每個class還有空chunk的slab
+    std::vector<Slab*> slabs;
+    std::unordered_map<uintptr_t, Slab*> pages;  // 位址 / kSlabSize -> slab
+    Slab* spare;                 // 保留的空slab，避免在slab邊界上反覆配置與釋放
+    size_t reserved;
+
+    static size_t classIndex(size_t bytes) {
+        if (bytes <= 128) return bytes == 0 ? 0 : (bytes + 15) / 16 - 1;
+        // bytes落在(2^k, 2^(k+1)]，區間分成4級
+        size_t k = 63 - __builtin_clzll(bytes - 1);
+        size_t sub = ((bytes - 1) >> (k - 2)) & 3;
+        return 8 + (k - 7) * 4 + sub;
+    }
+
+    static size_t sizeOfClass(size_t index) {
+        if (index < 8) return (index + 1) * 16;
+        size_t k = 7 + (index - 8) / 4;
+        size_t sub = (index - 8) % 4;
+        return (static_cast<size_t>(1) << k) + (sub + 1) * (static_cast<size_t>(1) << (k - 2));
+    }
+
+    // 取得一個slab(優先用保留的空slab)並切成chunk，放入該class的partial list
+    Slab* refill(size_t index) {
+        size_t chunkSize = sizeOfClass(index);
+        size_t slabSize = (chunkSize * 8 + kSlabSize - 1) / kSlabSize * kSlabSize;
+        Slab* slab;
+        if (spare != nullptr && spare->bytes == slabSize) {
+            slab = spare;
+            spare = nullptr;
+        } else {
+            char* base = static_cast<char*>(::operator new(slabSize, std::align_val_t(kSlabSize)));
+            slab = new Slab{base, slabSize, index, 0, nullptr, nullptr, nullptr, slabs.size()};
+            slabs.push_back(slab);
+            for (size_t offset = 0; offset < slabSize; offset += kSlabSize) {
+                pages[reinterpret_cast<uintptr_t>(base + offset) / kSlabSize] = slab;
+            }
+            reserved += slabSize;
+        }
+        slab->classIndex = index;
+        slab->freeChunks = nullptr;
+        for (size_t offset = 0; offset + chunkSize <= slabSize; offset += chunkSize) {
+            FreeChunk* chunk = reinterpret_cast<FreeChunk*>(slab->base + offset);
+            chunk->next = slab->freeChunks;
+            slab->freeChunks = chunk;
+        }
+        linkPartial(slab);
+        return slab;
+    }
+
+    // slab的chunk全部釋放：保留一個64KB的空slab，其餘還給系統
+    void releaseSlab(Slab* slab) {
+        unlinkPartial(slab);
+        if (spare == nullptr && slab->bytes == kSlabSize) {
+            spare = slab;
+            return;
+        }
+        for (size_t offset = 0; offset < slab->bytes; offset += kSlabSize) {
+            pages.erase(reinterpret_cast<uintptr_t>(slab->base + offset) / kSlabSize);
+        }
+        reserved -= slab->bytes;
+        ::operator delete(slab->base, std::align_val_t(kSlabSize));
+        Slab* last = slabs.back();
+        slabs[slab->index] = last;
+        last->index = slab->index;
+        slabs.pop_back();
+        delete slab;
+    }
+
+    void linkPartial(Slab* slab) {
+        Slab*& head = partial[slab->classIndex];
+        slab->prevPartial = nullptr;
+        slab->nextPartial = head;
+        if (head != nullptr) head->prevPartial = slab;
+        head = slab;
+    }
+
+    void unlinkPartial(Slab* slab) {
+        if (slab->prevPartial != nullptr) {
+            slab->prevPartial->nextPartial = slab->nextPartial;
+        } else {
+            partial[slab->classIndex] = slab->nextPartial;
+        }
+        if (slab->nextPartial != nullptr) slab->nextPartial->prevPartial = slab->prevPartial;
+        slab->prevPartial = nullptr;
+        slab->nextPartial = nullptr;
+    }
+};
+
+#endif // DRAM_ARENA_H
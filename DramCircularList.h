@@ -4,21 +4,35 @@
 #include <iostream>
 #include <cstdint>
 #include <string>
+#include <string_view>
 #include <cstring> 
+#include <new>
+#include "DramArena.h"
 
 using std::string;
+struct TimerEntry;
+
 class DramNode {
 public:
     char* key;
     char* data;
+    uint32_t keyLength;   // key/data可能包含'\0'，一律使用长度
+    uint32_t dataLength;
     size_t size;
     DramNode* prev;
     DramNode* next;
-    struct {
+    size_t swapIndex;   // 在ClockCache交换候选集合中的位置，kNotSwapCandidate表示不在集合中
+    unsigned int pins;  // 存活中的CacheHandle数量，大于0时不能被逐出、交换或释放
+    uint64_t hash;      // key的hash，由ClockCache放入索引时设定，删除与扩容时不必重新计算
+    uint64_t expiresAt; // 过期时间(毫秒)，0表示没有TTL；无锁的读者也会读取
+    TimerEntry* timer;  // 在ClockCache的timing wheel中的位置，没有TTL时为nullptr
+    struct Attributes {
         unsigned int reference : 1; 
         unsigned int status : 2;     
     } attributes;
 
+    static constexpr size_t kNotSwapCandidate = SIZE_MAX;
+
     enum DramNodeStatus {
         Initial = 0,
         Once_read = 1,
@@ -26,6 +40,9 @@ public:
         Be_Migration = 3
     };
 
+    std::string_view keyView() const { return std::string_view(key, keyLength); }
+    std::string_view dataView() const { return std::string_view(data, dataLength); }
+
     void setStatus(DramNodeStatus status) {
         attributes.status = static_cast<unsigned int>(status);
     }
@@ -34,14 +51,47 @@ public:
         return static_cast<DramNodeStatus>(attributes.status);
     }
 
+    // 可以和要遷移的NVM節點交換：已讀過兩次以上且最近一輪clock沒有被存取
+    bool isSwapEligible() const {
+        return attributes.status >= Twice_read && attributes.reference == 0 && pins == 0;
+    }
+
+    // 讀取命中：設定reference並推進status(Initial -> Once_read -> Twice_read -> Be_Migration)
+    // 以CAS更新整個attributes，讓無鎖的讀者和持鎖的clock sweep可以同時修改
+    void recordRead() {
+        Attributes expected, desired;
+        __atomic_load(&attributes, &expected, __ATOMIC_RELAXED);
+        do {
+            desired = expected;
+            desired.reference = 1;
+            if (desired.status != Be_Migration) {
+                desired.status = desired.status + 1;
+            }
+        } while (!__atomic_compare_exchange(&attributes, &expected, &desired, true,
+                                            __ATOMIC_RELAXED, __ATOMIC_RELAXED));
+    }
+
+    // clock sweep使用：清除reference，回傳清除前是否為1
+    bool testAndClearReference() {
+        Attributes expected, desired;
+        __atomic_load(&attributes, &expected, __ATOMIC_RELAXED);
+        do {
+            if (expected.reference == 0) return false;
+            desired = expected;
+            desired.reference = 0;
+        } while (!__atomic_compare_exchange(&attributes, &expected, &desired, true,
+                                            __ATOMIC_RELAXED, __ATOMIC_RELAXED));
+        return true;
+    }
+
 
-    DramNode(const std::string& key, const std::string& data, size_t size): prev(nullptr), next(nullptr), size(size){
-        size_t keySize = key.size() + 1;
-        size_t dataSize = data.size() + 1;
-        this->key = new char[keySize];
-        this->data = new char[dataSize];
-        std::strcpy(this->key, key.c_str());
-        std::strcpy(this->data, data.c_str());
+    // key與data緊接在節點後面，和節點在同一塊arena配置中(見DramCircularLinkedList::createNode)
+    DramNode(char* key, char* data, size_t keyLength, size_t dataLength, size_t size)
+        : keyLength(keyLength), dataLength(dataLength), prev(nullptr), next(nullptr), size(size),
+          swapIndex(kNotSwapCandidate), pins(0), hash(0), expiresAt(0), timer(nullptr) {
+        this->key = key;
+        this->data = data;
+        attributes = Attributes();
         attributes.reference = 0; 
         attributes.status = 0; 
     }
@@ -50,14 +100,64 @@ public:
 class DramCircularLinkedList {
 public:
     DramNode* head;
-    size_t currentSize; // 当前链表占用的总大小
+    DramNode* hand;     // clock指针，下一次逐出从这里开始扫描，nullptr表示从head开始
+    size_t currentSize; // 当前链表占用的总大小，以arena实际占用的chunk大小计算
+    DramArena arena;
+
+    DramCircularLinkedList(): head(nullptr), hand(nullptr), currentSize(0) {}
+
+    //key、'\0'、data、'\0'緊接在節點後面，和NvmCircularLinkedList的格式相同，
+    //兩個tier之間搬移時可以整段複製
+    static size_t payloadSize(size_t keySize, size_t dataSize) {
+        return (keySize + 1) + (dataSize + 1);
+    }
+
+    //節點與payload放在同一塊配置中
+    static size_t allocSize(size_t keySize, size_t dataSize) {
+        return sizeof(DramNode) + payloadSize(keySize, dataSize);
+    }
+
+    //節點實際佔用的DRAM大小(arena的size class)
+    static size_t nodeSize(size_t keySize, size_t dataSize) {
+        return DramArena::classSize(allocSize(keySize, dataSize));
+    }
+
+    DramNode* createNode(std::string_view key, std::string_view data) {
+        size_t totalSize = allocSize(key.size(), data.size());
+        void* ptr = arena.allocate(totalSize);
 
-    DramCircularLinkedList(): head(nullptr), currentSize(0) {}
+        char* keyPtr = reinterpret_cast<char*>(ptr) + sizeof(DramNode);
+        char* dataPtr = keyPtr + key.size() + 1;
 
-    //在DramNode()裡面會使用char來做搬移，實際大小會是key.size() + 1
-    void insertNode(const std::string& key, const std::string& data) {
-        size_t nodeSize = (key.size() + 1) + (data.size() + 1 )+ sizeof(DramNode);
-        DramNode* newNode = new DramNode(key, data, nodeSize);
+        memcpy(keyPtr, key.data(), key.size());
+        keyPtr[key.size()] = '\0';
+        memcpy(dataPtr, data.data(), data.size());
+        dataPtr[data.size()] = '\0';
+
+        return new (ptr) DramNode(keyPtr, dataPtr, key.size(), data.size(), DramArena::classSize(totalSize));
+    }
+
+    //從相同格式的payload(例如NvmNode的)建立節點，只需要一次memcpy
+    DramNode* createNodeFromPayload(const char* payload, size_t keySize, size_t dataSize) {
+        size_t totalSize = allocSize(keySize, dataSize);
+        void* ptr = arena.allocate(totalSize);
+
+        char* keyPtr = reinterpret_cast<char*>(ptr) + sizeof(DramNode);
+        memcpy(keyPtr, payload, payloadSize(keySize, dataSize));
+
+        return new (ptr) DramNode(keyPtr, keyPtr + keySize + 1, keySize, dataSize, DramArena::classSize(totalSize));
+    }
+
+    DramNode* insertNode(std::string_view key, std::string_view data) {
+        return linkNode(createNode(key, data));
+    }
+
+    DramNode* insertPayload(const char* payload, size_t keySize, size_t dataSize) {
+        return linkNode(createNodeFromPayload(payload, keySize, dataSize));
+    }
+
+    //把新節點接在head之前(環的尾端)
+    DramNode* linkNode(DramNode* newNode) {
         if (head == nullptr) {
             head = newNode;
             newNode->next = newNode;
@@ -68,23 +168,45 @@ public:
             head->prev->next = newNode;
             head->prev = newNode;
         }
-        currentSize += nodeSize; 
+        currentSize += newNode->size; 
+        return newNode;
+    }
+
+    // 新data放得進節點原本的chunk時直接覆寫，保留節點在環中的位置
+    // 回傳false表示需要重新配置(放不下，或新data小到會浪費一半以上的chunk)
+    bool overwriteData(DramNode* node, std::string_view data) {
+        size_t newSize = nodeSize(node->keyLength, data.size());
+        if (newSize > node->size || newSize * 2 < node->size) return false;
+        memcpy(node->data, data.data(), data.size());
+        node->data[data.size()] = '\0';
+        node->dataLength = data.size();
+        return true;
     }
 
     void deleteNode(DramNode* node) {
         if (node == nullptr) return;
+        unlinkNode(node);
+        freeNode(node);
+    }
 
+    // 只從環中移除並扣除大小，不釋放記憶體(給延後回收使用)
+    void unlinkNode(DramNode* node) {
         if (node == node->next) {
             head = nullptr;
+            hand = nullptr;
         } else {
+            if (hand == node) hand = node->next;
             node->prev->next = node->next;
             node->next->prev = node->prev;
             if (head == node) head = node->next;
         }
         currentSize -= node->size; 
-        delete[] node->key;
-        delete[] node->data;
-        delete node;
+    }
+
+    void freeNode(DramNode* node) {
+        size_t size = node->size;
+        node->~DramNode();
+        arena.deallocate(node, size);
     }
 
     ~DramCircularLinkedList() {
@@ -92,7 +214,7 @@ public:
             deleteNode(head);
         }
         if (head) {
-            delete head;
+            freeNode(head);
             head = nullptr;
         }
     }
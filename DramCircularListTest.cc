@@ -119,11 +119,11 @@ TEST_F(CircularListDramTest, NodeStatusTransition) {
 // 测试插入节点后currentSize的更新
 TEST_F(CircularListDramTest, CurrentSizeAfterInsertion) {
     list->insertNode("key1", "data1");
-    size_t expectedSize = sizeof(DramNode) + strlen("key1") + 1 + strlen("data1") + 1;
+    size_t expectedSize = DramCircularLinkedList::nodeSize(strlen("key1"), strlen("data1"));
     EXPECT_EQ(list->currentSize, expectedSize);
 
     list->insertNode("key2", "data2");
-    expectedSize += sizeof(DramNode) + strlen("key2") + 1 + strlen("data2") + 1;
+    expectedSize += DramCircularLinkedList::nodeSize(strlen("key2"), strlen("data2"));
     EXPECT_EQ(list->currentSize, expectedSize);
 }
 
@@ -134,7 +134,7 @@ TEST_F(CircularListDramTest, CurrentSizeAfterDeletion) {
     size_t initialSize = list->currentSize;
 
     list->deleteNode(list->head->next); // 删除"key2", "data2"
-    size_t expectedSizeAfterDeletion = initialSize - (sizeof(DramNode) + strlen("key2") + 1 + strlen("data2") + 1);
+    size_t expectedSizeAfterDeletion = initialSize - DramCircularLinkedList::nodeSize(strlen("key2"), strlen("data2"));
     EXPECT_EQ(list->currentSize, expectedSizeAfterDeletion);
 }
 
@@ -156,6 +156,74 @@ TEST_F(CircularListDramTest, CurrentSizeAfterClearingList) {
     EXPECT_EQ(list->currentSize, 0);
 }
 
+// 测试删除clock hand所在的节点后hand移到下一个节点
+TEST_F(CircularListDramTest, HandAdvancesWhenNodeDeleted) {
+    list->insertNode("key1", "data1");
+    list->insertNode("key2", "data2");
+    EXPECT_EQ(list->hand, nullptr);
+
+    list->hand = list->head;
+    DramNode* second = list->head->next;
+    list->deleteNode(list->head);
+    EXPECT_EQ(list->hand, second);
+
+    list->deleteNode(second);
+    EXPECT_EQ(list->hand, nullptr);
+}
+
+// 测试节点大小以arena的size class计算，且包含节点、key与data
+TEST_F(CircularListDramTest, NodeSizeUsesArenaSizeClass) {
+    EXPECT_EQ(DramArena::classSize(1), 16);
+    EXPECT_EQ(DramArena::classSize(128), 128);
+    EXPECT_EQ(DramArena::classSize(129), 160);
+    EXPECT_EQ(DramArena::classSize(257), 320);
+    EXPECT_EQ(DramArena::classSize(DramArena::kMaxClassSize), DramArena::kMaxClassSize);
+    EXPECT_EQ(DramArena::classSize(DramArena::kMaxClassSize + 1), DramArena::kMaxClassSize + DramArena::kPageSize);
+
+    size_t rawSize = sizeof(DramNode) + strlen("key1") + 1 + strlen("data1") + 1;
+    size_t nodeSize = DramCircularLinkedList::nodeSize(strlen("key1"), strlen("data1"));
+    EXPECT_GE(nodeSize, rawSize);
+    EXPECT_EQ(nodeSize, DramArena::classSize(rawSize));
+}
+
+// 测试key与data和节点放在同一块配置中，删除后的空间会被重用
+TEST_F(CircularListDramTest, NodeMemoryIsInlineAndReused) {
+    list->insertNode("key1", "data1");
+    DramNode* node = list->head;
+    EXPECT_EQ(node->key, reinterpret_cast<char*>(node) + sizeof(DramNode));
+    EXPECT_EQ(node->data, node->key + strlen("key1") + 1);
+    EXPECT_STREQ(node->key, "key1");
+    EXPECT_STREQ(node->data, "data1");
+
+    size_t reserved = list->arena.reservedBytes();
+    list->deleteNode(node);
+    list->insertNode("key2", "data2");
+    EXPECT_EQ(list->head, node);
+    EXPECT_EQ(list->arena.reservedBytes(), reserved);
+
+    // 大於size class上限的節點直接向系統配置
+    std::string bigData(DramArena::kMaxClassSize, 'x');
+    list->insertNode("bigKey", bigData);
+    EXPECT_EQ(list->head->prev->data, bigData);
+    EXPECT_EQ(list->currentSize, DramCircularLinkedList::nodeSize(strlen("key2"), strlen("data2")) +
+                                 DramCircularLinkedList::nodeSize(strlen("bigKey"), bigData.size()));
+}
+
+// 测试key与data可以包含'\0'，并且可以从另一个节点的payload整段复制
+TEST_F(CircularListDramTest, InsertPayloadCopiesBinaryData) {
+    std::string key("k\0ey", 4);
+    std::string data("da\0\0ta", 6);
+    DramNode* source = list->insertNode(key, data);
+    EXPECT_EQ(source->keyView(), key);
+    EXPECT_EQ(source->dataView(), data);
+
+    DramNode* copy = list->insertPayload(source->key, source->keyLength, source->dataLength);
+    EXPECT_NE(copy, source);
+    EXPECT_EQ(copy->keyView(), key);
+    EXPECT_EQ(copy->dataView(), data);
+    EXPECT_EQ(copy->size, source->size);
+    EXPECT_EQ(list->head->prev, copy);
+}
 
 
 int main(int argc, char **argv) {
@@ -0,0 +1,74 @@
+#ifndef EPOCH_H
+#define EPOCH_H
+
+#include <atomic>
+#include <cstdint>
+#include <functional>
+#include <thread>
+
+// Epoch-based reclamation (EBR)
+// 讀者進入臨界區時將目前的global epoch寫入一個slot，離開時清為0。
+// 寫者unlink節點後以當下的epoch標記它，只有當所有活躍slot的epoch都大於該標記時才能真正釋放。
+class EpochManager {
+public:
+    static const size_t kSlots = 256;
+
+    class Guard {
+    public:
+        explicit Guard(EpochManager* manager) : manager(manager), slot(manager->enter()) {}
+        ~Guard() { manager->exit(slot); }
+        Guard(const Guard&) = delete;
+        Guard& operator=(const Guard&) = delete;
+    private:
+        EpochManager* manager;
+        size_t slot;
+    };
+
+    EpochManager() : globalEpoch(1) {
+        for (size_t i = 0; i < kSlots; i++) {
+            slots[i].epoch.store(0, std::memory_order_relaxed);
+        }
+    }
+
+    uint64_t currentEpoch() const {
+        return globalEpoch.load(std::memory_order_seq_cst);
+    }
+
+    // 推進epoch，並回傳目前仍可能被讀者看見的最小epoch
+    // 以小於此值的epoch標記的節點都可以安全釋放
+    uint64_t advanceAndGetSafeEpoch() {
+        uint64_t safe = globalEpoch.fetch_add(1, std::memory_order_seq_cst) + 1;
+        for (size_t i = 0; i < kSlots; i++) {
+            uint64_t pinned = slots[i].epoch.load(std::memory_order_seq_cst);
+            if (pinned != 0 && pinned < safe) safe = pinned;
+        }
+        return safe;
+    }
+
+private:
+    struct alignas(64) Slot {
+        std::atomic<uint64_t> epoch;
+    };
+
+    std::atomic<uint64_t> globalEpoch;
+    Slot slots[kSlots];
+
+    size_t enter() {
+        size_t start = std::hash<std::thread::id>()(std::this_thread::get_id());
+        for (size_t i = 0; ; i++) {
+            size_t index = (start + i) % kSlots;
+            uint64_t expected = 0;
+            uint64_t epoch = globalEpoch.load(std::memory_order_seq_cst);
+            if (slots[index].epoch.compare_exchange_strong(expected, epoch, std::memory_order_seq_cst)) {
+                return index;
+            }
+            if (i > 0 && i % kSlots == 0) std::this_thread::yield();
+        }
+    }
+
+    void exit(size_t slot) {
+        slots[slot].epoch.store(0, std::memory_order_release);
+    }
+};
+
+#endif // EPOCH_H
@@ -0,0 +1,85 @@
+#ifndef FREQUENCY_SKETCH_H
+#define FREQUENCY_SKETCH_H
+
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+
+// TinyLFU用的count-min sketch(參考Caffeine的FrequencySketch)
+// 每個uint64_t存16個4-bit計數器，一個key在4個不同的word各對應一個計數器，估計值取最小值。
+// 每個預期的entry約8個計數器(4 bytes)；累積expectedEntries * 10次increment後所有計數器減半，
+// 讓舊的熱度逐漸淡出。只用key的hash，不保存key。
+// 不是thread-safe，由ClockCache的呼叫者串行化。
+class FrequencySketch {
+public:
+    static constexpr unsigned int kMaxCount = 15;
+
+    explicit FrequencySketch(size_t expectedEntries) : additions(0) {
+        size_t words = 8;
+        while (words * 2 < expectedEntries) words <<= 1;
+        tableMask = words - 1;
+        table.reset(new uint64_t[words]());
+        sampleSize = (expectedEntries > 0 ? expectedEntries : 1) * 10;
+    }
+
+    FrequencySketch(const FrequencySketch&) = delete;
+    FrequencySketch& operator=(const FrequencySketch&) = delete;
+
+    // 記錄一次存取，已經飽和的計數器不再增加
+    void increment(uint64_t hash) {
+        bool added = false;
+        for (unsigned int row = 0; row < 4; row++) {
+            size_t word;
+            unsigned int shift;
+            locate(hash, row, &word, &shift);
+            if (((table[word] >> shift) & kMaxCount) != kMaxCount) {
+                table[word] += static_cast<uint64_t>(1) << shift;
+                added = true;
+            }
+        }
+        if (added && ++additions >= sampleSize) {
+            reset();
+        }
+    }
+
+    // 估計的存取次數(0~15)
+    unsigned int frequency(uint64_t hash) const {
+        unsigned int count = kMaxCount;
+        for (unsigned int row = 0; row < 4; row++) {
+            size_t word;
+            unsigned int shift;
+            locate(hash, row, &word, &shift);
+            unsigned int value = static_cast<unsigned int>((table[word] >> shift) & kMaxCount);
+            if (value < count) count = value;
+        }
+        return count;
+    }
+
+    // 所有計數器減半(老化)
+    void reset() {
+        for (size_t i = 0; i <= tableMask; i++) {
+            table[i] = (table[i] >> 1) & 0x7777777777777777ULL;
+        }
+        additions /= 2;
+    }
+
+    size_t sizeInBytes() const { return (tableMask + 1) * sizeof(uint64_t); }
+
+private:
+    std::unique_ptr<uint64_t[]> table;
+    size_t tableMask;
+    size_t additions;  // 上次老化之後的increment次數
+    size_t sampleSize;
+
+    // 每一列用不同的常數重新混合hash：高位選word，低4位選word內的計數器
+    void locate(uint64_t hash, unsigned int row, size_t* word, unsigned int* shift) const {
+        static const uint64_t kSeeds[4] = {0x9E3779B97F4A7C15ULL, 0xC2B2AE3D27D4EB4FULL,
+                                           0x165667B19E3779F9ULL, 0xFF51AFD7ED558CCDULL};
+        uint64_t h = (hash + row) * kSeeds[row];
+        h ^= h >> 29;
+        *word = static_cast<size_t>(h >> 32) & tableMask;
+        *shift = static_cast<unsigned int>(h & 15) * 4;
+    }
+};
+
+#endif // FREQUENCY_SKETCH_H
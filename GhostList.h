@@ -0,0 +1,51 @@
+#ifndef GHOST_LIST_H
+#define GHOST_LIST_H
+
+#include <cstddef>
+#include <cstdint>
+#include <iterator>
+#include <list>
+#include <unordered_map>
+
+// ARC的ghost list：最近被逐出的key，只保存hash，不保存key與value
+// 超過capacity時丟掉最早加入的hash；take()命中時移除該hash。
+// 不是thread-safe，由ClockCache的呼叫者串行化。
+class GhostList {
+public:
+    explicit GhostList(size_t capacity) : capacity(capacity) {}
+
+    GhostList(const GhostList&) = delete;
+    GhostList& operator=(const GhostList&) = delete;
+
+    void add(uint64_t hash) {
+        if (capacity == 0) return;
+        auto it = positions.find(hash);
+        if (it != positions.end()) {
+            order.erase(it->second);
+            positions.erase(it);
+        } else if (order.size() >= capacity) {
+            positions.erase(order.front());
+            order.pop_front();
+        }
+        order.push_back(hash);
+        positions.emplace(hash, std::prev(order.end()));
+    }
+
+    // hash在list中時移除並回傳true
+    bool take(uint64_t hash) {
+        auto it = positions.find(hash);
+        if (it == positions.end()) return false;
+        order.erase(it->second);
+        positions.erase(it);
+        return true;
+    }
+
+    size_t size() const { return order.size(); }
+
+private:
+    size_t capacity;
+    std::list<uint64_t> order;  // 最早加入的在前面
+    std::unordered_map<uint64_t, std::list<uint64_t>::iterator> positions;
+};
+
+#endif // GHOST_LIST_H
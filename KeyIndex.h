@@ -0,0 +1,228 @@
+#ifndef KEY_INDEX_H
+#define KEY_INDEX_H
+
+#include "DramCircularList.h"
+#include "NvmCircularList.h"
+#include "ConcurrentReadIndex.h"
+#include <cstdint>
+#include <cstring>
+#include <memory>
+#include <string_view>
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+
+// DRAM與NVM共用的key索引(Swiss table式的open addressing)
+// 每個slot存放節點指標，最低位元標記NVM節點(和ConcurrentReadIndex相同)，
+// 另外用一個byte的控制陣列存放hash的低7位元作為指紋，16個slot一組以SSE2一次比對。
+// key與hash存在節點上，比對時不需要另外保存字串，擴容時也不必重新計算hash。
+// 不是thread-safe，由ClockCache的呼叫者串行化。
+class KeyIndex {
+public:
+    static const uintptr_t kNvmTag = ConcurrentReadIndex::kNvmTag;
+    static const size_t kGroupWidth = 16;
+
+    explicit KeyIndex(size_t capacity = kGroupWidth) : count(0), used(0), removals(0) {
+        size_t slotCount = kGroupWidth;
+        while (slotCount < capacity) slotCount <<= 1;
+        allocate(slotCount);
+    }
+
+    KeyIndex(const KeyIndex&) = delete;
+    KeyIndex& operator=(const KeyIndex&) = delete;
+
+    static DramNode* dramNode(uintptr_t tagged) {
+        return (tagged & kNvmTag) ? nullptr : reinterpret_cast<DramNode*>(tagged);
+    }
+
+    static NvmNode* nvmNode(uintptr_t tagged) {
+        return (tagged & kNvmTag) ? reinterpret_cast<NvmNode*>(tagged & ~kNvmTag) : nullptr;
+    }
+
+    // 回傳key對應的節點(含tier標記)，找不到回傳0
+    uintptr_t find(std::string_view key, uint64_t hash) const {
+        size_t slot = findSlot(key, hash);
+        return slot == kNotFound ? 0 : slots[slot];
+    }
+
+    // 預取hash探測的第一組控制byte與slot，批次查詢時先對整批hash呼叫，之後的find()不必等待這兩次cache miss
+    void prefetch(uint64_t hash) const {
+        size_t group = groupOf(hash) & (capacity / kGroupWidth - 1);
+        __builtin_prefetch(ctrl.get() + group * kGroupWidth);
+        // 一組slot佔兩條cache line
+        const uintptr_t* groupSlots = slots.get() + group * kGroupWidth;
+        __builtin_prefetch(groupSlots);
+        __builtin_prefetch(groupSlots + kGroupWidth / 2);
+    }
+
+    // 批次查詢的第二階段：prefetch()載入的控制byte與slot已經到了之後，預取第一組中指紋相符的節點
+    // (標頭與緊接在後面的key)，find()比對key時這些cache miss已經在進行中
+    void prefetchNodes(uint64_t hash) const {
+        size_t group = groupOf(hash) & (capacity / kGroupWidth - 1);
+        uint32_t matches = matchByte(group, fingerprint(hash));
+        while (matches != 0) {
+            uintptr_t tagged = slots[group * kGroupWidth + __builtin_ctz(matches)];
+            const char* node = reinterpret_cast<const char*>(tagged & ~kNvmTag);
+            __builtin_prefetch(node);
+            __builtin_prefetch(node + ((tagged & kNvmTag) ? sizeof(NvmNode) : sizeof(DramNode)));
+            matches &= matches - 1;
+        }
+    }
+
+    // 放入節點，key已經存在時(不論在哪個tier)改為指向新節點，回傳被取代的節點
+    uintptr_t insert(std::string_view key, uint64_t hash, uintptr_t tagged) {
+        size_t slot = findSlot(key, hash);
+        if (slot != kNotFound) {
+            uintptr_t old = slots[slot];
+            slots[slot] = tagged;
+            removals++;
+            return old;
+        }
+        if ((used + 1) * 8 > capacity * 7) {
+            // 刪除標記太多時原地重建，否則擴大一倍
+            rehash(count * 2 >= capacity ? capacity * 2 : capacity);
+        }
+        slot = findFreeSlot(hash);
+        if (ctrl[slot] == kEmpty) used++;
+        ctrl[slot] = fingerprint(hash);
+        slots[slot] = tagged;
+        count++;
+        return 0;
+    }
+
+    // 只有key仍指向tagged時才移除，避免刪掉已被新節點取代的entry
+    bool erase(std::string_view key, uint64_t hash, uintptr_t tagged) {
+        size_t slot = findSlot(key, hash);
+        if (slot == kNotFound || slots[slot] != tagged) return false;
+        // 同一組裡還有空slot時，探測序列一定會停在這組，可以直接標記為空
+        size_t group = slot / kGroupWidth;
+        if (matchByte(group, kEmpty) != 0) {
+            ctrl[slot] = kEmpty;
+            used--;
+        } else {
+            ctrl[slot] = kDeleted;
+        }
+        slots[slot] = 0;
+        count--;
+        removals++;
+        return true;
+    }
+
+    size_t size() const { return count; }
+
+    // 被移除或取代的entry累計數量。沒有變化時，先前find()回傳的節點都還有效(批次操作用它決定要不要重新查詢)
+    uint64_t removalCount() const { return removals; }
+
+private:
+    static const uint8_t kEmpty = 0x80;
+    static const uint8_t kDeleted = 0xFE;
+    static const size_t kNotFound = SIZE_MAX;
+
+    std::unique_ptr<uint8_t[]> ctrl;
+    std::unique_ptr<uintptr_t[]> slots;
+    size_t capacity;
+    size_t count;  // 有效的entry數量
+    size_t used;   // 有效的entry加上刪除標記，決定何時擴容
+    uint64_t removals;
+
+    static uint8_t fingerprint(uint64_t hash) { return static_cast<uint8_t>(hash & 0x7F); }
+    static size_t groupOf(uint64_t hash) { return static_cast<size_t>(hash >> 7); }
+
+    static uint64_t hashOf(uintptr_t tagged) {
+        if (tagged & kNvmTag) return nvmNode(tagged)->hash;
+        return dramNode(tagged)->hash;
+    }
+
+    static bool keyEquals(uintptr_t tagged, std::string_view key, uint64_t hash) {
+        if (tagged & kNvmTag) {
+            NvmNode* node = nvmNode(tagged);
+            return node->hash == hash && key == node->keyView();
+        }
+        DramNode* node = dramNode(tagged);
+        return node->hash == hash && key == node->keyView();
+    }
+
+    void allocate(size_t slotCount) {
+        capacity = slotCount;
+        ctrl.reset(new uint8_t[slotCount]);
+        slots.reset(new uintptr_t[slotCount]);
+        std::memset(ctrl.get(), kEmpty, slotCount);
+        std::memset(slots.get(), 0, slotCount * sizeof(uintptr_t));
+    }
+
+    // 回傳組內控制byte等於value的slot的bitmask
+    uint32_t matchByte(size_t group, uint8_t value) const {
+        const uint8_t* bytes = ctrl.get() + group * kGroupWidth;
+#ifdef __SSE2__
+        __m128i ctrlBytes = _mm_loadu_si128(reinterpret_cast<const __m128i*>(bytes));
+        __m128i match = _mm_cmpeq_epi8(ctrlBytes, _mm_set1_epi8(static_cast<char>(value)));
+        return static_cast<uint32_t>(_mm_movemask_epi8(match));
+#else
+        uint32_t mask = 0;
+        for (size_t i = 0; i < kGroupWidth; i++) {
+            if (bytes[i] == value) mask |= 1u << i;
+        }
+        return mask;
+#endif
+    }
+
+    // 回傳組內空slot或刪除標記的bitmask(控制byte最高位元為1)
+    uint32_t matchFree(size_t group) const {
+        const uint8_t* bytes = ctrl.get() + group * kGroupWidth;
+#ifdef __SSE2__
+        __m128i ctrlBytes = _mm_loadu_si128(reinterpret_cast<const __m128i*>(bytes));
+        return static_cast<uint32_t>(_mm_movemask_epi8(ctrlBytes));
+#else
+        uint32_t mask = 0;
+        for (size_t i = 0; i < kGroupWidth; i++) {
+            if (bytes[i] & 0x80) mask |= 1u << i;
+        }
+        return mask;
+#endif
+    }
+
+    // 以組為單位做三角數探測，組數是2的冪次所以會走遍所有組
+    size_t findSlot(std::string_view key, uint64_t hash) const {
+        size_t groupMask = capacity / kGroupWidth - 1;
+        size_t group = groupOf(hash) & groupMask;
+        uint8_t fp = fingerprint(hash);
+        for (size_t step = 1;; step++) {
+            uint32_t matches = matchByte(group, fp);
+            while (matches != 0) {
+                size_t slot = group * kGroupWidth + __builtin_ctz(matches);
+                if (keyEquals(slots[slot], key, hash)) return slot;
+                matches &= matches - 1;
+            }
+            if (matchByte(group, kEmpty) != 0) return kNotFound;
+            group = (group + step) & groupMask;
+        }
+    }
+
+    size_t findFreeSlot(uint64_t hash) const {
+        size_t groupMask = capacity / kGroupWidth - 1;
+        size_t group = groupOf(hash) & groupMask;
+        for (size_t step = 1;; step++) {
+            uint32_t free = matchFree(group);
+            if (free != 0) return group * kGroupWidth + __builtin_ctz(free);
+            group = (group + step) & groupMask;
+        }
+    }
+
+    // 節點上存有hash，重建時不需要讀key
+    void rehash(size_t newCapacity) {
+        std::unique_ptr<uint8_t[]> oldCtrl = std::move(ctrl);
+        std::unique_ptr<uintptr_t[]> oldSlots = std::move(slots);
+        size_t oldCapacity = capacity;
+        allocate(newCapacity);
+        used = count;
+        for (size_t i = 0; i < oldCapacity; i++) {
+            if (oldCtrl[i] & 0x80) continue;
+            uint64_t hash = hashOf(oldSlots[i]);
+            size_t slot = findFreeSlot(hash);
+            ctrl[slot] = fingerprint(hash);
+            slots[slot] = oldSlots[i];
+        }
+    }
+};
+
+#endif // KEY_INDEX_H
@@ -0,0 +1,110 @@
+#include "KeyIndex.h"
+#include <gtest/gtest.h>
+#include <functional>
+#include <vector>
+
+class KeyIndexTest : public ::testing::Test {
+protected:
+    KeyIndex* index;
+    DramCircularLinkedList* list;
+
+    virtual void SetUp() {
+        index = new KeyIndex();
+        list = new DramCircularLinkedList();
+    }
+
+    virtual void TearDown() {
+        delete index;
+        delete list;
+    }
+
+    // 插入DRAM節點並設定hash，回傳節點
+    DramNode* addNode(const std::string& key, uint64_t hash) {
+        list->insertNode(key, "data");
+        DramNode* node = list->head->prev;
+        node->hash = hash;
+        return node;
+    }
+
+    static uint64_t hashOf(std::string_view key) {
+        return std::hash<std::string_view>()(key);
+    }
+};
+
+// 测试插入后可以找到，找不到的key回传0
+TEST_F(KeyIndexTest, InsertAndFind) {
+    DramNode* node = addNode("key1", hashOf("key1"));
+    EXPECT_EQ(index->insert("key1", node->hash, reinterpret_cast<uintptr_t>(node)), 0);
+    EXPECT_EQ(KeyIndex::dramNode(index->find("key1", hashOf("key1"))), node);
+    EXPECT_EQ(index->find("key2", hashOf("key2")), 0);
+    EXPECT_EQ(index->size(), 1);
+}
+
+// 测试同一个key改放到NVM节点时会取代原本的entry
+TEST_F(KeyIndexTest, InsertReplacesAcrossTiers) {
+    DramNode* dramNode = addNode("key1", hashOf("key1"));
+    uintptr_t dramTagged = reinterpret_cast<uintptr_t>(dramNode);
+    index->insert("key1", dramNode->hash, dramTagged);
+    EXPECT_EQ(index->removalCount(), 0);
+
+    char key[] = "key1";
+    char data[] = "nvmData";
+    alignas(8) NvmNode nvmNode(key, data, strlen(key), strlen(data), 0);
+    nvmNode.hash = dramNode->hash;
+    uintptr_t nvmTagged = reinterpret_cast<uintptr_t>(&nvmNode) | KeyIndex::kNvmTag;
+    EXPECT_EQ(index->insert("key1", nvmNode.hash, nvmTagged), dramTagged);
+    EXPECT_EQ(index->removalCount(), 1);
+
+    uintptr_t found = index->find("key1", nvmNode.hash);
+    EXPECT_EQ(KeyIndex::dramNode(found), nullptr);
+    EXPECT_EQ(KeyIndex::nvmNode(found), &nvmNode);
+    EXPECT_EQ(index->size(), 1);
+
+    // 舊節點已經不在索引中，刪除舊節點不能影響新entry
+    EXPECT_FALSE(index->erase("key1", dramNode->hash, dramTagged));
+    EXPECT_TRUE(index->erase("key1", nvmNode.hash, nvmTagged));
+    EXPECT_EQ(index->find("key1", nvmNode.hash), 0);
+    EXPECT_EQ(index->removalCount(), 2);
+}
+
+// 测试fingerprint与hash相同时仍以key区分
+TEST_F(KeyIndexTest, CollidingHashesAreSeparatedByKey) {
+    DramNode* first = addNode("first", 42);
+    DramNode* second = addNode("second", 42);
+    index->insert("first", 42, reinterpret_cast<uintptr_t>(first));
+    index->insert("second", 42, reinterpret_cast<uintptr_t>(second));
+    // 批次查詢的兩階段預取不改變查詢結果
+    index->prefetch(42);
+    index->prefetchNodes(42);
+    EXPECT_EQ(KeyIndex::dramNode(index->find("first", 42)), first);
+    EXPECT_EQ(KeyIndex::dramNode(index->find("second", 42)), second);
+    index->erase("first", 42, reinterpret_cast<uintptr_t>(first));
+    EXPECT_EQ(KeyIndex::dramNode(index->find("second", 42)), second);
+}
+
+// 测试扩容与大量删除后所有key仍然可以找到
+TEST_F(KeyIndexTest, GrowAndEraseMany) {
+    std::vector<DramNode*> nodes;
+    for (int i = 0; i < 1000; ++i) {
+        std::string key = "key" + std::to_string(i);
+        nodes.push_back(addNode(key, hashOf(key)));
+        index->insert(key, nodes.back()->hash, reinterpret_cast<uintptr_t>(nodes.back()));
+    }
+    EXPECT_EQ(index->size(), 1000);
+    for (int i = 0; i < 1000; i += 2) {
+        EXPECT_TRUE(index->erase(nodes[i]->key, nodes[i]->hash, reinterpret_cast<uintptr_t>(nodes[i])));
+    }
+    EXPECT_EQ(index->size(), 500);
+    for (int i = 0; i < 1000; ++i) {
+        uintptr_t found = index->find(nodes[i]->key, nodes[i]->hash);
+        EXPECT_EQ(found, i % 2 == 0 ? 0 : reinterpret_cast<uintptr_t>(nodes[i]));
+    }
+    // 刪除標記會在之後的插入中被重用或清掉
+    for (int i = 0; i < 1000; i += 2) {
+        index->insert(nodes[i]->key, nodes[i]->hash, reinterpret_cast<uintptr_t>(nodes[i]));
+    }
+    EXPECT_EQ(index->size(), 1000);
+    for (int i = 0; i < 1000; ++i) {
+        EXPECT_EQ(KeyIndex::dramNode(index->find(nodes[i]->key, nodes[i]->hash)), nodes[i]);
+    }
+}
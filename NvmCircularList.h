@@ -3,18 +3,85 @@
 #include <iostream>
 #include <cstdint>
 #include <string>
+#include <string_view>
 #include <cstring>
+#include <functional>
+#include <new>
+#include <random>
+#include <vector>
 #include "pm_manager.h"
+#include "DramArena.h"
 
-#include "pm_manager.h"
+struct TimerEntry;
+
+// NVM entry持久化的部分，也是pool中唯一配置的東西：recovery需要的標頭，後面接著payload(key, '\0', data, '\0')。
+// 讀取與clock sweep會碰到的欄位都在DRAM端的NvmNode，讀取命中和sweep不會寫入NVM。
+struct NvmRecord {
+    uint32_t keyLength;
+    uint32_t dataLength;
+    uint64_t size;      // 配置的大小，NVM容量以它計算
+    uint64_t version;   // list每建立一個record就遞增，recovery時較新的勝出
+    uint32_t state;     // 只有Live的record會被找回
+    uint32_t checksum;  // 見computeChecksum()
+    uint64_t segmentId; // record所在的log segment的id，單獨配置的record為0
+    uint64_t expiresAt; // 過期的wall clock時間(毫秒)，0表示沒有TTL
+
+    enum State : uint32_t {
+        Live = 1,
+        Retired = 2    // 已移出環、等待釋放，key可能已經有較新的record
+    };
+
+    char* payload() { return reinterpret_cast<char*>(this + 1); }
+    const char* payload() const { return reinterpret_cast<const char*>(this + 1); }
+    std::string_view keyView() const { return std::string_view(payload(), keyLength); }
+
+    // 涵蓋payload與標頭欄位：沒有完整寫到媒體上的record(覆寫到一半，或Async/Volatile模式下crash)
+    // 會在recovery時被發現並丟棄，不會被讀到
+    uint32_t computeChecksum() const {
+        uint64_t h = std::hash<std::string_view>()(std::string_view(payload(), keyLength + 1 + dataLength + 1));
+        h ^= ((static_cast<uint64_t>(keyLength) << 32) | dataLength) * 0x9E3779B97F4A7C15ULL;
+        h ^= (version + size) * 0xC2B2AE3D27D4EB4FULL;
+        h ^= segmentId * 0x165667B19E3779F9ULL;
+        h ^= expiresAt * 0xFF51AFD7ED558CCDULL;
+        return static_cast<uint32_t>(h ^ (h >> 32));
+    }
+};
+
+// log segment開頭的持久化標頭，record依序append在後面
+struct NvmSegmentHeader {
+    uint64_t magic;
+    uint64_t id;        // 隨機產生，之前的segment留在同一塊記憶體中的record不會符合
+    uint64_t capacity;
+};
 
+// log segment在DRAM中的記錄(見NvmCircularLinkedList::enableLog)
+struct NvmSegment {
+    char* base;         // pool中的物件，NvmSegmentHeader後面接著record
+    size_t capacity;
+    size_t tail;        // 下一次append的位置
+    size_t liveBytes;   // 仍在環中的record的bytes
+    size_t records;     // 還沒釋放的record數，sealed segment在降到0時釋放
+    size_t index;       // 在NvmCircularLinkedList::segments中的位置
+};
+
+// NVM entry在DRAM中的shadow：環的鏈結、狀態位元與key的副本(key緊接在節點後面)，data指向NVM record中的value。
+// shadow由shadowArena配置，不計入NVM容量也不計入DRAM容量，大小見NvmCircularLinkedList::shadowBytes，
+// 上限由ClockCache::setNvmShadowBudget()設定。
 class NvmNode {
 public:
     char* key;
     char* data;
+    uint32_t keyLength;   // key/data可能包含'\0'，一律使用長度
+    uint32_t dataLength;
     size_t size;
     NvmNode* prev;
     NvmNode* next;
+    unsigned int pins;  // 存在的CacheHandle數，被pin住的節點不會被逐出、遷移或釋放
+    uint64_t hash;      // key的hash，ClockCache放入索引時設定
+    NvmRecord* record;  // pool中的record
+    NvmSegment* segment; // record所在的log segment，單獨配置時為nullptr
+    uint64_t expiresAt;  // record->expiresAt的副本，給無鎖讀者使用
+    TimerEntry* timer;   // 在ClockCache的timing wheel中的位置，沒有TTL時為nullptr
 
     struct Attributes {
         unsigned int reference : 1; 
@@ -29,14 +96,22 @@ public:
         Migration = 3
     };
 
-    NvmNode(char* key, char* data, size_t size): prev(nullptr), next(nullptr), size(size) {
+    NvmNode(char* key, char* data, size_t keyLength, size_t dataLength, size_t size, NvmRecord* record = nullptr)
+        : keyLength(keyLength), dataLength(dataLength), prev(nullptr), next(nullptr), pins(0), hash(0), size(size),
+          record(record), segment(nullptr), expiresAt(0), timer(nullptr) {
         this->key = key;
         this->data = data;
+        attributes = Attributes();
         attributes.reference = 0;
         setStatus(Initial);   
         attributes.twiceRead = 0;
     }
 
+    std::string_view keyView() const { return std::string_view(key, keyLength); }
+    std::string_view dataView() const { return std::string_view(data, dataLength); }
+    // NVM record中連續存放的key與data，複製到DRAM時使用
+    const char* payload() const { return record->payload(); }
+
     void setStatus(NvmNodeStatus status) {
         attributes.status = static_cast<unsigned int>(status);
     }
@@ -48,37 +123,173 @@ public:
     bool isStatus(NvmNodeStatus status) const {
         return getStatus() == status;
     }
+
+    // 讀取命中：第一次讀只設定twiceRead，連續第二次讀才把status往回降一級
+    // 以CAS更新整個attributes，讓無鎖的讀者和持鎖的clock sweep可以同時修改
+    void recordRead() {
+        Attributes expected, desired;
+        __atomic_load(&attributes, &expected, __ATOMIC_RELAXED);
+        do {
+            desired = expected;
+            if (expected.twiceRead == 1) {
+                if (expected.status == Pre_Migration) {
+                    desired.status = Be_Written;
+                } else if (expected.status == Be_Written) {
+                    desired.status = Initial;
+                }
+                desired.twiceRead = 0;
+            } else {
+                desired.twiceRead = 1;
+            }
+        } while (!__atomic_compare_exchange(&attributes, &expected, &desired, true,
+                                            __ATOMIC_RELAXED, __ATOMIC_RELAXED));
+    }
+
+    // clock sweep使用：清除reference，回傳清除前是否為1
+    bool testAndClearReference() {
+        Attributes expected, desired;
+        __atomic_load(&attributes, &expected, __ATOMIC_RELAXED);
+        do {
+            if (expected.reference == 0) return false;
+            desired = expected;
+            desired.reference = 0;
+        } while (!__atomic_compare_exchange(&attributes, &expected, &desired, true,
+                                            __ATOMIC_RELAXED, __ATOMIC_RELAXED));
+        return true;
+    }
 };
 
 class NvmCircularLinkedList {
 public:
     NvmNode* head;
+    NvmNode* hand;       // clock hand，下一次逐出從這裡開始掃描(nullptr表示head)
     PMmanager* pm_;
-    size_t currentSize;  //Current size of this LinkedList
+    size_t currentSize;  // 目前佔用的NVM bytes
+    uint64_t nextVersion;
+    DramArena shadowArena;  // 節點的DRAM shadow
+    size_t shadowBytes;     // shadow佔用的DRAM(arena的size class)，不計入任何tier的容量，另有自己的預算
 
-    NvmCircularLinkedList(PMmanager* pm): head(nullptr), pm_(pm), currentSize(0) {}
+    // log-structured模式：record依序append到segmentSize大小的segment，不再各自配置。
+    // 0(預設)表示每個record單獨配置
+    size_t segmentSize;
+    NvmSegment* active;                 // 目前接受append的segment，其餘都已sealed
+    std::vector<NvmSegment*> segments;  // 所有segment，包含active
+    size_t sealedCapacity;              // sealed segment的容量總和
+    size_t sealedLive;                  // sealed segment中仍在環中的bytes
+    std::mt19937_64 segmentIds;
 
-    NvmNode* createNode(std::string key, std::string data) {
-        size_t keySize = key.size() + 1; 
-        size_t dataSize = data.size() + 1; 
+    // pmemobj的type number，recovery以它找出record與segment
+    static const uint64_t kRecordType = 1;
+    static const uint64_t kSegmentType = 2;
+    static const uint64_t kSegmentMagic = 0x4e564d4c4f475347ULL;
+    static const size_t kSegmentHeaderSize = sizeof(NvmSegmentHeader);
+    static const size_t kRecordAlign = 8;
+    static const size_t kDefaultSegmentSize = 1024 * 1024;
 
-        size_t totalSize = sizeof(NvmNode) + keySize + dataSize;
+    // pool的root物件，記錄record的格式；格式不同時record無法讀回，整個pool直接丟棄
+    struct Root {
+        uint64_t magic;
+        uint64_t recordHeaderSize;
+    };
+    static const uint64_t kRootMagic = 0x434c4f434b525746ULL;
 
-        void* ptr = pm_->Allocate(totalSize);
+    NvmCircularLinkedList(PMmanager* pm)
+        : head(nullptr), hand(nullptr), pm_(pm), currentSize(0), nextVersion(1), shadowBytes(0), segmentSize(0), active(nullptr),
+          sealedCapacity(0), sealedLive(0), segmentIds(std::random_device()()) {}
 
-        char* keyPtr = reinterpret_cast<char*>(ptr) + sizeof(NvmNode);
-        char* dataPtr = keyPtr + keySize;
+    // 切換到log-structured模式：新的record依序append到segment，刪除時只標記Retired，
+    // segment中的record都不再使用時整個segment還給pool。已經配置的record留在原處
+    void enableLog(size_t segmentSize = kDefaultSegmentSize) {
+        this->segmentSize = segmentSize;
+    }
 
-        strcpy(keyPtr, key.c_str());
-        strcpy(dataPtr, data.c_str());
+    bool isLogStructured() const { return segmentSize != 0; }
 
-        NvmNode* newNode = new (ptr) NvmNode(keyPtr, dataPtr, totalSize);
+    // NVM容量以它計算：live record的bytes加上sealed segment中的dead bytes(Retired的record、標頭與沒用到的尾端)，
+    // 這些空間要等segment被壓縮或釋放才會還給pool。active segment還沒append的部分不計入
+    size_t usedBytes() const { return currentSize + (sealedCapacity - sealedLive); }
 
-        return newNode;
+    // 刪除node之後usedBytes()減少的bytes：sealed segment中的record刪除後只是變成dead bytes
+    size_t releasableBytes(const NvmNode* node) const {
+        return node->segment != nullptr && node->segment != active ? 0 : node->size;
+    }
+
+    // 寫入size bytes的record之後usedBytes()增加的bytes：active segment放不下時會被seal，
+    // 它的dead bytes與沒用到的尾端也一起計入
+    size_t appendBytes(size_t size) const {
+        size_t span = recordSpan(size);
+        if (active == nullptr || active->records == 0 || kSegmentHeaderSize + span > segmentSize ||
+            active->tail + span <= active->capacity) {
+            return size;
+        }
+        return size + (active->capacity - active->liveBytes);
+    }
+
+    // payload接在record標頭後面：key, '\0', data, '\0'。DramCircularLinkedList使用相同的格式，
+    // entry在兩個tier之間搬移時整段複製payload即可
+    static size_t payloadSize(size_t keySize, size_t dataSize) {
+        return (keySize + 1) + (dataSize + 1);
     }
 
-    void insertNode(std::string key, std::string data) {
-        NvmNode* newNode = createNode(key, data);
+    // entry佔用的NVM bytes，不包含DRAM shadow
+    static size_t nodeSize(size_t keySize, size_t dataSize) {
+        return sizeof(NvmRecord) + payloadSize(keySize, dataSize);
+    }
+
+    static size_t shadowSize(size_t keySize) {
+        return sizeof(NvmNode) + keySize + 1;
+    }
+
+    // 一個entry的shadow讓shadowBytes增加的bytes
+    static size_t shadowFootprint(size_t keySize) {
+        return DramArena::classSize(shadowSize(keySize));
+    }
+
+    // record在segment中佔用的bytes，讓每個record標頭保持對齊
+    static size_t recordSpan(size_t size) {
+        return (size + kRecordAlign - 1) & ~(kRecordAlign - 1);
+    }
+
+    // expiresAt存在record中，暖啟動時不會找回已經過期的entry
+    NvmNode* createNode(std::string_view key, std::string_view data, uint64_t expiresAt = 0) {
+        RecordImage image = {pm_, key.data(), key.size(), data.data(), data.size(), nextVersion++, 0, expiresAt};
+        return createRecordNode(image);
+    }
+
+    // 從上述格式的payload(例如DramNode的)建立節點，整段複製，不需要掃描長度
+    NvmNode* createNodeFromPayload(const char* payload, size_t keySize, size_t dataSize, uint64_t expiresAt = 0) {
+        RecordImage image = {pm_, payload, keySize, nullptr, dataSize, nextVersion++, 0, expiresAt};
+        return createRecordNode(image);
+    }
+
+    // 新value放得進record原本的配置時原地覆寫，需要重新配置時回傳false。
+    // 中途crash會留下checksum不符的record，recovery時被丟棄，不會讀到寫了一半的value
+    bool overwriteData(NvmNode* node, std::string_view data, uint64_t expiresAt = 0) {
+        size_t newSize = nodeSize(node->keyLength, data.size());
+        if (newSize > node->size || newSize * 2 < node->size) return false;
+        NvmRecord* record = node->record;
+        pm_->Copy(node->data, data.data(), data.size());
+        node->data[data.size()] = '\0';
+        record->dataLength = data.size();
+        record->expiresAt = expiresAt;
+        record->checksum = record->computeChecksum();
+        pm_->Sync(node->data, data.size() + 1);
+        pm_->Sync(record, sizeof(NvmRecord));
+        node->dataLength = data.size();
+        node->expiresAt = expiresAt;
+        return true;
+    }
+
+    NvmNode* insertNode(std::string_view key, std::string_view data, uint64_t expiresAt = 0) {
+        return linkNode(createNode(key, data, expiresAt));
+    }
+
+    NvmNode* insertPayload(const char* payload, size_t keySize, size_t dataSize, uint64_t expiresAt = 0) {
+        return linkNode(createNodeFromPayload(payload, keySize, dataSize, expiresAt));
+    }
+
+    // 把新節點接在head之前(環的尾端)，只修改DRAM shadow
+    NvmNode* linkNode(NvmNode* newNode) {
         if (head == nullptr) {
             head = newNode;
             newNode->next = newNode; 
@@ -90,18 +301,161 @@ public:
             head->prev = newNode;
         }
         currentSize += newNode->size; 
+        if (NvmSegment* segment = newNode->segment) {
+            segment->liveBytes += newNode->size;
+            if (segment != active) sealedLive += newNode->size;
+        }
+        return newNode;
     }
 
     void deleteNode(NvmNode* node) {
+        unlinkNode(node);
+        freeNode(node);
+    }
+
+    // 只從環中移除並扣除大小，不釋放記憶體(給延後回收使用)
+    // record會先被標記為Retired，回收前crash也不會在recovery時復活舊的value
+    void unlinkNode(NvmNode* node) {
+        NvmRecord* record = node->record;
+        record->state = NvmRecord::Retired;
+        pm_->Sync(&record->state, sizeof(record->state));
         if (node == node->next) {
             head = nullptr;
+            hand = nullptr;
         } else {
+            if (hand == node) hand = node->next;
             node->prev->next = node->next;
             node->next->prev = node->prev;
             if (head == node) head = node->next;
         }
         currentSize -= node->size; 
-        pm_->Free(node);
+        if (NvmSegment* segment = node->segment) {
+            segment->liveBytes -= node->size;
+            if (segment != active) sealedLive -= node->size;
+        }
+    }
+
+    void freeNode(NvmNode* node) {
+        if (NvmSegment* segment = node->segment) {
+            segment->records--;
+            if (segment != active && segment->records == 0) releaseSegment(segment);
+        } else {
+            pm_->Free(node->record);
+        }
+        freeShadow(node);
+    }
+
+    // 釋放recoverRecords()交出但沒有被任何list接收的record；segment中的record不處理，
+    // 由recoverRecords()釋放整個segment
+    void freeRecord(NvmRecord* record) {
+        if (record->segmentId == 0) pm_->Free(record);
+    }
+
+    // 為recoverRecords()找到的record建立DRAM shadow並接入環。單獨配置的record留在原處(log-structured時除外)；
+    // segment中的record一律複製出來(保留version)，因為同一個segment可能有被分給其他list的record
+    NvmNode* adoptRecord(NvmRecord* record) {
+        if (record->version >= nextVersion) nextVersion = record->version + 1;
+        if (record->segmentId == 0 && !isLogStructured()) {
+            return linkNode(createShadow(record, nullptr));
+        }
+        RecordImage image = {pm_, record->payload(), record->keyLength, nullptr, record->dataLength,
+                             record->version, 0, record->expiresAt};
+        NvmNode* node = linkNode(createRecordNode(image));
+        freeRecord(record);
+        return node;
+    }
+
+    // compaction使用：sealed segment平均live比例低於liveRatio時回傳true，
+    // 這時compactionCandidate(liveRatio)一定找得到segment，除非其餘的都只是在等待釋放
+    bool needsCompaction(double liveRatio) const {
+        return static_cast<double>(sealedLive) < liveRatio * static_cast<double>(sealedCapacity);
+    }
+
+    // live比例最低且低於liveRatio的sealed segment。沒有live bytes的segment跳過，
+    // 它們在record被回收後就會釋放
+    NvmSegment* compactionCandidate(double liveRatio) const {
+        NvmSegment* best = nullptr;
+        for (NvmSegment* segment : segments) {
+            if (segment == active || segment->liveBytes == 0 || segment->liveBytes >= liveRatio * segment->capacity) {
+                continue;
+            }
+            if (best == nullptr || segment->liveBytes * best->capacity < best->liveBytes * segment->capacity) {
+                best = segment;
+            }
+        }
+        return best;
+    }
+
+    // 走訪segment中append過的record，包含Retired的
+    void forEachRecord(NvmSegment* segment, const std::function<void(NvmRecord*)>& visit) const {
+        for (size_t offset = kSegmentHeaderSize; offset < segment->tail;) {
+            NvmRecord* record = reinterpret_cast<NvmRecord*>(segment->base + offset);
+            offset += recordSpan(record->size);
+            visit(record);
+        }
+    }
+
+    // 釋放所有DRAM shadow但保留record，留在pool中給下一次recoverRecords()(暖啟動)
+    void detach() {
+        while (head != nullptr) {
+            NvmNode* node = head;
+            head = node->next == node ? nullptr : node->next;
+            node->prev->next = node->next;
+            node->next->prev = node->prev;
+            freeShadow(node);
+        }
+        for (NvmSegment* segment : segments) {
+            delete segment;
+        }
+        segments.clear();
+        active = nullptr;
+        sealedCapacity = 0;
+        sealedLive = 0;
+        hand = nullptr;
+        currentSize = 0;
+    }
+
+    // 走訪pool，把每個Live的record交給visit()，由它放入某個list(adoptRecord)或釋放(freeRecord)。
+    // 等待釋放或checksum不符的record在這裡釋放，每個log segment在它的record都走訪過後釋放。
+    // 必須在pool中任何list配置之前呼叫
+    static void recoverRecords(PMmanager* pm, const std::function<void(NvmRecord*)>& visit) {
+        Root* root = static_cast<Root*>(pm->Root(sizeof(Root)));
+        bool compatible = root->magic == kRootMagic && root->recordHeaderSize == sizeof(NvmRecord);
+        // 先收集：放入list時可能配置，新的物件不能出現在走訪中
+        std::vector<void*> records;
+        std::vector<void*> logSegments;
+        void* ptr = pm->First();
+        while (ptr != nullptr) {
+            void* next = pm->Next(ptr);
+            if (ptr == root) {
+                // root物件不是record
+            } else if (!compatible) {
+                pm->Free(ptr);
+            } else if (pm->TypeOf(ptr) == kRecordType) {
+                records.push_back(ptr);
+            } else if (pm->TypeOf(ptr) == kSegmentType) {
+                logSegments.push_back(ptr);
+            }
+            ptr = next;
+        }
+        if (!compatible) {
+            root->magic = kRootMagic;
+            root->recordHeaderSize = sizeof(NvmRecord);
+            pm->Sync(root, sizeof(Root));
+        }
+
+        for (void* object : records) {
+            NvmRecord* record = static_cast<NvmRecord*>(object);
+            if (record->segmentId == 0 && isValid(record, pm->UsableSize(object))) {
+                visit(record);
+            } else {
+                pm->Free(record);
+            }
+        }
+        for (void* object : logSegments) {
+            recoverSegment(pm, static_cast<char*>(object), visit);
+            pm->Free(object);
+        }
     }
 
     ~NvmCircularLinkedList() {
@@ -109,14 +463,168 @@ public:
             deleteNode(head);
         }
         if (head) {
-            pm_->Free(head);
+            freeNode(head);
             head = nullptr;
         }
         currentSize = 0; 
+        // record都已經釋放，只剩下active segment
+        if (active != nullptr) sealActive();
+    }
+
+private:
+    // 配置時constructor寫入的內容：key與data，data為nullptr時key指向整段payload
+    struct RecordImage {
+        PMmanager* pm;
+        const char* key;
+        size_t keySize;
+        const char* data;
+        size_t dataSize;
+        uint64_t version;
+        uint64_t segmentId;
+        uint64_t expiresAt;
+    };
+
+    // 在大型配置對pool可見之前執行(pmemobj_alloc、mapped heap)，或用在從PMmanager配置cache取出的物件上，
+    // 兩種情況下寫了一半的record都會被checksum發現。payload經由PMmanager::Copy寫入，
+    // 在真正的PM上大的value以non-temporal store寫入
+    static int constructRecord(PMEMobjpool*, void* ptr, void* arg) {
+        const RecordImage* image = static_cast<const RecordImage*>(arg);
+        NvmRecord* record = static_cast<NvmRecord*>(ptr);
+        record->keyLength = image->keySize;
+        record->dataLength = image->dataSize;
+        record->size = nodeSize(image->keySize, image->dataSize);
+        record->version = image->version;
+        record->state = NvmRecord::Live;
+        record->segmentId = image->segmentId;
+        record->expiresAt = image->expiresAt;
+        char* keyPtr = record->payload();
+        if (image->data == nullptr) {
+            image->pm->Copy(keyPtr, image->key, payloadSize(image->keySize, image->dataSize));
+        } else {
+            char* dataPtr = keyPtr + image->keySize + 1;
+            memcpy(keyPtr, image->key, image->keySize);
+            keyPtr[image->keySize] = '\0';
+            image->pm->Copy(dataPtr, image->data, image->dataSize);
+            dataPtr[image->dataSize] = '\0';
+        }
+        record->checksum = record->computeChecksum();
+        image->pm->Sync(ptr, record->size);
+        return 0;
+    }
+
+    NvmRecord* allocateRecord(RecordImage& image) {
+        size_t totalSize = nodeSize(image.keySize, image.dataSize);
+        return static_cast<NvmRecord*>(pm_->Allocate(totalSize, kRecordType, constructRecord, &image));
+    }
+
+    static bool isValid(const NvmRecord* record, size_t available) {
+        return record->state == NvmRecord::Live &&
+               record->size <= available &&
+               nodeSize(record->keyLength, record->dataLength) <= record->size &&
+               record->checksum == record->computeChecksum();
+    }
+
+    // record是連續append的，掃描停在第一個不屬於這個segment的位置：append的結尾
+    // (沒有寫過，或是同一塊記憶體之前的配置留下的、segment id不同的資料)或寫了一半的標頭
+    static void recoverSegment(PMmanager* pm, char* base, const std::function<void(NvmRecord*)>& visit) {
+        const NvmSegmentHeader* header = reinterpret_cast<const NvmSegmentHeader*>(base);
+        if (header->magic != kSegmentMagic || header->capacity > pm->UsableSize(base)) return;
+        size_t offset = kSegmentHeaderSize;
+        while (offset + sizeof(NvmRecord) <= header->capacity) {
+            NvmRecord* record = reinterpret_cast<NvmRecord*>(base + offset);
+            if (record->segmentId != header->id || record->size < sizeof(NvmRecord) ||
+                record->size > header->capacity - offset) {
+                break;
+            }
+            if (isValid(record, header->capacity - offset)) visit(record);
+            offset += recordSpan(record->size);
+        }
+    }
+
+    struct SegmentImage {
+        PMmanager* pm;
+        NvmSegmentHeader header;
+    };
+
+    // 只寫入標頭，recoverSegment()的掃描不需要把其餘部分清為0
+    static int constructSegment(PMEMobjpool*, void* ptr, void* arg) {
+        const SegmentImage* image = static_cast<const SegmentImage*>(arg);
+        *static_cast<NvmSegmentHeader*>(ptr) = image->header;
+        image->pm->Sync(ptr, kSegmentHeaderSize);
+        return 0;
+    }
+
+    // 放不進segment的record單獨配置
+    NvmNode* createRecordNode(RecordImage& image) {
+        size_t span = recordSpan(nodeSize(image.keySize, image.dataSize));
+        if (!isLogStructured() || kSegmentHeaderSize + span > segmentSize) {
+            return createShadow(allocateRecord(image), nullptr);
+        }
+        if (active == nullptr || active->tail + span > active->capacity) {
+            sealActive();
+            active = allocateSegment();
+        }
+        char* ptr = active->base + active->tail;
+        image.segmentId = reinterpret_cast<NvmSegmentHeader*>(active->base)->id;
+        constructRecord(nullptr, ptr, &image);
+        active->tail += span;
+        active->records++;
+        return createShadow(reinterpret_cast<NvmRecord*>(ptr), active);
+    }
+
+    NvmSegment* allocateSegment() {
+        SegmentImage image = {pm_, {kSegmentMagic, 0, segmentSize}};
+        while (image.header.id == 0) image.header.id = segmentIds();
+        char* base = static_cast<char*>(pm_->Allocate(segmentSize, kSegmentType, constructSegment, &image));
+        NvmSegment* segment = new NvmSegment{base, segmentSize, kSegmentHeaderSize, 0, 0, segments.size()};
+        segments.push_back(segment);
+        return segment;
+    }
+
+    void sealActive() {
+        if (active == nullptr) return;
+        NvmSegment* segment = active;
+        active = nullptr;
+        sealedCapacity += segment->capacity;
+        sealedLive += segment->liveBytes;
+        if (segment->records == 0) releaseSegment(segment);
+    }
+
+    // record全部釋放的sealed segment還給pool
+    void releaseSegment(NvmSegment* segment) {
+        sealedCapacity -= segment->capacity;
+        sealedLive -= segment->liveBytes;
+        pm_->Free(segment->base);
+        NvmSegment* last = segments.back();
+        segments[segment->index] = last;
+        last->index = segment->index;
+        segments.pop_back();
+        delete segment;
+    }
+
+    // key複製到shadow中，查詢與比對只需要讀DRAM
+    NvmNode* createShadow(NvmRecord* record, NvmSegment* segment) {
+        size_t keySize = record->keyLength;
+        char* ptr = static_cast<char*>(shadowArena.allocate(shadowSize(keySize)));
+        char* keyPtr = ptr + sizeof(NvmNode);
+        memcpy(keyPtr, record->payload(), keySize + 1);
+        NvmNode* node = new (ptr) NvmNode(keyPtr, record->payload() + keySize + 1, keySize, record->dataLength,
+                                          record->size, record);
+        node->segment = segment;
+        node->expiresAt = record->expiresAt;
+        shadowBytes += shadowFootprint(keySize);
+        return node;
+    }
+
+    void freeShadow(NvmNode* node) {
+        size_t bytes = shadowSize(node->keyLength);
+        shadowBytes -= shadowFootprint(node->keyLength);
+        node->~NvmNode();
+        shadowArena.deallocate(node, bytes);
     }
 };
 
 
 
 
-#endif // CIRCULAR_LIST_H
\ No newline at end of file
+#endif // CIRCULAR_LIST_H
@@ -2,6 +2,7 @@
 #include "pm_manager.h"
 #include <gtest/gtest.h>
 #include <string>
+#include <vector>
 
 class CircularListNvmTest : public ::testing::Test {
 protected:
@@ -122,11 +123,11 @@ TEST_F(CircularListNvmTest, CurrentSizeAfterInsertion) {
     NvmCircularLinkedList list(pm);
 
     list.insertNode("key1", "data1");
-    size_t expectedSizeAfterFirstInsert = sizeof(NvmNode) + strlen("key1") + 1 + strlen("data1") + 1;
+    size_t expectedSizeAfterFirstInsert = sizeof(NvmRecord) + strlen("key1") + 1 + strlen("data1") + 1;
     EXPECT_EQ(list.currentSize, expectedSizeAfterFirstInsert);
 
     list.insertNode("key2", "data2");
-    size_t expectedSizeAfterSecondInsert = expectedSizeAfterFirstInsert + sizeof(NvmNode) + strlen("key2") + 1 + strlen("data2") + 1;
+    size_t expectedSizeAfterSecondInsert = expectedSizeAfterFirstInsert + sizeof(NvmRecord) + strlen("key2") + 1 + strlen("data2") + 1;
     EXPECT_EQ(list.currentSize, expectedSizeAfterSecondInsert);
 }
 
@@ -140,7 +141,7 @@ TEST_F(CircularListNvmTest, CurrentSizeAfterDeletion) {
 
     NvmNode* nodeToDelete = list.head->next; // 删除第二个插入的节点
     list.deleteNode(nodeToDelete);
-    size_t expectedSizeAfterDeletion = sizeBeforeDeletion - (sizeof(NvmNode) + strlen("key2") + 1 + strlen("data2") + 1);
+    size_t expectedSizeAfterDeletion = sizeBeforeDeletion - (sizeof(NvmRecord) + strlen("key2") + 1 + strlen("data2") + 1);
     EXPECT_EQ(list.currentSize, expectedSizeAfterDeletion);
 }
 
@@ -162,6 +163,196 @@ TEST_F(CircularListNvmTest, CurrentSizeAfterClearingList) {
     EXPECT_EQ(list.currentSize, 0);
 }
 
+// 测试删除clock hand所在的节点后hand移到下一个节点
+TEST_F(CircularListNvmTest, HandAdvancesWhenNodeDeleted) {
+    NvmCircularLinkedList list(pm);
+
+    list.insertNode("key1", "data1");
+    list.insertNode("key2", "data2");
+    EXPECT_EQ(list.hand, nullptr);
+
+    list.hand = list.head;
+    NvmNode* second = list.head->next;
+    list.deleteNode(list.head);
+    EXPECT_EQ(list.hand, second);
+
+    list.deleteNode(second);
+    EXPECT_EQ(list.hand, nullptr);
+}
+
+// 测试Async模式下Sync()成批persist，Volatile模式下不flush
+TEST_F(CircularListNvmTest, DurabilityModes) {
+    PMmanager asyncPm("circular_list_async_gtest", Durability::Async);
+    EXPECT_EQ(asyncPm.GetDurability(), Durability::Async);
+    {
+        NvmCircularLinkedList list(&asyncPm);
+        for (int i = 0; i < 200; ++i) {
+            list.insertNode("key" + std::to_string(i), "data");
+        }
+        asyncPm.Drain();
+        EXPECT_EQ(asyncPm.PendingSyncs(), 0);
+        EXPECT_GT(asyncPm.GroupCommits(), 0);
+        EXPECT_LT(asyncPm.GroupCommits(), 200);
+    }
+
+    PMmanager volatilePm("circular_list_volatile_gtest", Durability::Volatile);
+    NvmCircularLinkedList list(&volatilePm);
+    list.insertNode("key1", "data1");
+    volatilePm.Drain();
+    EXPECT_EQ(volatilePm.PendingSyncs(), 0);
+    EXPECT_EQ(volatilePm.GroupCommits(), 0);
+    EXPECT_EQ(list.head->dataView(), "data1");
+}
+
+// 测试配置快取：一次publish保留一批物件，释放的物件回到快取并被重用，recovery时不会被当成record
+TEST_F(CircularListNvmTest, AllocationCacheReusesFreedRecords) {
+    PMmanager cachePm("circular_list_cache_gtest");
+    NvmCircularLinkedList::recoverRecords(&cachePm, [&cachePm](NvmRecord* record) { cachePm.Free(record); });
+    uint64_t publishes = cachePm.BatchPublishes();
+    NvmCircularLinkedList list(&cachePm);
+    std::vector<NvmNode*> nodes;
+    for (int i = 0; i < 8; ++i) {
+        nodes.push_back(list.insertNode("key" + std::to_string(i), "data"));
+    }
+    EXPECT_EQ(cachePm.BatchPublishes(), publishes + 1);
+
+    NvmRecord* freed = nodes[3]->record;
+    list.deleteNode(nodes[3]);
+    EXPECT_EQ(freed->state, 0);
+    NvmNode* reused = list.insertNode("key8", "data");
+    EXPECT_EQ(reused->record, freed);
+    EXPECT_EQ(reused->dataView(), "data");
+    EXPECT_EQ(cachePm.BatchPublishes(), publishes + 1);
+
+    // 快取中的物件在recovery前还给pool，只有真正的record会被走访到
+    list.detach();
+    size_t recovered = 0;
+    NvmCircularLinkedList::recoverRecords(&cachePm, [&cachePm, &recovered](NvmRecord* record) {
+        recovered++;
+        cachePm.Free(record);
+    });
+    EXPECT_EQ(recovered, 8);
+}
+
+// 测试pmem_map_file backend：释放的block被重用，重新映射后可以找回record(包含大的value)
+TEST_F(CircularListNvmTest, MappedBackendSurvivesReopen) {
+    PMmanager* mappedPm = new PMmanager("circular_list_mapped_gtest", Durability::Strict, Backend::Mapped);
+    EXPECT_EQ(mappedPm->GetBackend(), Backend::Mapped);
+    NvmCircularLinkedList::recoverRecords(mappedPm, [mappedPm](NvmRecord* record) { mappedPm->Free(record); });
+    std::string largeValue(8192, 'v');
+    {
+        NvmCircularLinkedList list(mappedPm);
+        NvmNode* removed = list.insertNode("key1", "data1");
+        NvmRecord* freed = removed->record;
+        list.deleteNode(removed);
+        EXPECT_EQ(list.insertNode("key2", "data2")->record, freed);
+        list.insertNode("key3", largeValue);
+        list.detach();
+    }
+    delete mappedPm;
+
+    mappedPm = new PMmanager("circular_list_mapped_gtest", Durability::Strict, Backend::Mapped);
+    {
+        NvmCircularLinkedList list(mappedPm);
+        NvmCircularLinkedList::recoverRecords(mappedPm, [&list](NvmRecord* record) { list.adoptRecord(record); });
+        ASSERT_NE(list.head, nullptr);
+        EXPECT_EQ(list.head->next->next, list.head);
+        EXPECT_EQ(list.currentSize, NvmCircularLinkedList::nodeSize(4, 5) + NvmCircularLinkedList::nodeSize(4, 8192));
+        NvmNode* large = list.head->keyView() == "key3" ? list.head : list.head->next;
+        EXPECT_EQ(large->dataView(), largeValue);
+    }
+    delete mappedPm;
+}
+
+// 测试Async模式下关闭pool前会persist剩下的范围，重新开启后可以找回节点
+TEST_F(CircularListNvmTest, AsyncNodesSurviveReopen) {
+    PMmanager* asyncPm = new PMmanager("circular_list_reopen_gtest", Durability::Async);
+    NvmCircularLinkedList::recoverRecords(asyncPm, [asyncPm](NvmRecord* record) { asyncPm->Free(record); });
+    {
+        NvmCircularLinkedList list(asyncPm);
+        list.insertNode("key1", "data1");
+        list.insertNode("key2", "data2");
+        list.detach();
+    }
+    delete asyncPm;
+
+    asyncPm = new PMmanager("circular_list_reopen_gtest", Durability::Async);
+    {
+        NvmCircularLinkedList list(asyncPm);
+        NvmCircularLinkedList::recoverRecords(asyncPm, [&list](NvmRecord* record) { list.adoptRecord(record); });
+        ASSERT_NE(list.head, nullptr);
+        EXPECT_EQ(list.head->next->next, list.head);
+        EXPECT_EQ(list.currentSize, 2 * NvmCircularLinkedList::nodeSize(4, 5));
+        EXPECT_GT(list.nextVersion, 2);
+    }
+    delete asyncPm;
+}
+
+// 测试log-structured模式下record依序append到segment，segment中的record都释放后归还pool
+TEST_F(CircularListNvmTest, LogAppendsRecordsIntoSegments) {
+    NvmCircularLinkedList list(pm);
+    list.enableLog(256);
+    size_t span = NvmCircularLinkedList::recordSpan(NvmCircularLinkedList::nodeSize(4, 6));
+    size_t perSegment = (256 - NvmCircularLinkedList::kSegmentHeaderSize) / span;
+
+    std::vector<NvmNode*> nodes;
+    for (size_t i = 0; i < perSegment + 1; i++) {
+        nodes.push_back(list.insertNode("key" + std::to_string(i), "value" + std::to_string(i)));
+    }
+    ASSERT_EQ(list.segments.size(), 2);
+    EXPECT_EQ(nodes[0]->segment, nodes[perSegment - 1]->segment);
+    EXPECT_EQ(reinterpret_cast<char*>(nodes[1]->record), reinterpret_cast<char*>(nodes[0]->record) + span);
+    EXPECT_EQ(nodes[perSegment]->segment, list.active);
+    EXPECT_EQ(list.sealedCapacity, 256);
+    EXPECT_EQ(list.currentSize, (perSegment + 1) * NvmCircularLinkedList::nodeSize(4, 6));
+
+    // 删除只标记Retired，第一个segment的record全部释放后才归还
+    NvmSegment* sealed = nodes[0]->segment;
+    for (size_t i = 0; i < perSegment - 1; i++) {
+        list.deleteNode(nodes[i]);
+    }
+    EXPECT_EQ(list.segments.size(), 2);
+    EXPECT_EQ(sealed->liveBytes, NvmCircularLinkedList::nodeSize(4, 6));
+    EXPECT_TRUE(list.needsCompaction(0.5));
+    EXPECT_EQ(list.compactionCandidate(0.5), sealed);
+    list.deleteNode(nodes[perSegment - 1]);
+    EXPECT_EQ(list.segments.size(), 1);
+    EXPECT_EQ(list.sealedCapacity, 0);
+    EXPECT_EQ(list.compactionCandidate(0.5), nullptr);
+}
+
+// 测试重新开启pool后可以从segment找回record，Retired与checksum不符的record被丢弃
+TEST_F(CircularListNvmTest, LogRecordsSurviveReopen) {
+    PMmanager* logPm = new PMmanager("circular_list_log_gtest");
+    NvmCircularLinkedList::recoverRecords(logPm, [logPm](NvmRecord* record) { logPm->Free(record); });
+    {
+        NvmCircularLinkedList list(logPm);
+        list.enableLog(4096);
+        list.insertNode("key1", "data1");
+        list.deleteNode(list.insertNode("key2", "data2"));
+        list.insertNode("key3", "data3")->data[0] = 'X';
+        list.insertNode("key4", "data4");
+        list.detach();
+    }
+    delete logPm;
+
+    logPm = new PMmanager("circular_list_log_gtest");
+    {
+        NvmCircularLinkedList list(logPm);
+        list.enableLog(4096);
+        NvmCircularLinkedList::recoverRecords(logPm, [&list](NvmRecord* record) { list.adoptRecord(record); });
+        ASSERT_NE(list.head, nullptr);
+        EXPECT_EQ(list.head->next->next, list.head);
+        EXPECT_EQ(list.head->keyView(), "key1");
+        EXPECT_EQ(list.head->next->keyView(), "key4");
+        EXPECT_EQ(list.head->next->dataView(), "data4");
+        // 找回的record复制到新的segment，原本的segment已经释放
+        EXPECT_EQ(list.segments.size(), 1);
+        EXPECT_EQ(list.head->segment, list.active);
+        EXPECT_EQ(list.currentSize, 2 * NvmCircularLinkedList::nodeSize(4, 5));
+    }
+    delete logPm;
+}
 
 int main(int argc, char **argv) {
     ::testing::InitGoogleTest(&argc, argv);
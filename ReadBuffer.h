@@ -0,0 +1,83 @@
+#ifndef READ_BUFFER_H
+#define READ_BUFFER_H
+
+#include <atomic>
+#include <cstdint>
+#include <functional>
+#include <thread>
+
+// 無鎖讀取命中時的存取事件緩衝(參考Caffeine的read buffer)
+// 每個執行緒依thread id對應到一個stripe，stripe是有界的環狀緩衝區。
+// 讀者只寫入事件，不修改節點；持有shard鎖的一方批次取出事件並更新節點狀態。
+// stripe滿了或CAS競爭失敗時直接丟棄事件，clock的狀態本來就只是近似值。
+class ReadBuffer {
+public:
+    static const size_t kStripes = 16;
+    static const uint32_t kStripeSize = 32;
+    static const uint32_t kDrainThreshold = kStripeSize / 2;
+
+    ReadBuffer() {
+        for (size_t i = 0; i < kStripes; i++) {
+            stripes[i].writeCount.store(0, std::memory_order_relaxed);
+            stripes[i].readCount.store(0, std::memory_order_relaxed);
+            for (uint32_t j = 0; j < kStripeSize; j++) {
+                stripes[i].slots[j].node.store(0, std::memory_order_relaxed);
+                stripes[i].slots[j].hash.store(0, std::memory_order_relaxed);
+            }
+        }
+    }
+
+    // 讀者：記錄一次命中，回傳true表示該stripe已累積足夠事件，應該嘗試drain
+    bool record(uintptr_t node, uint64_t hash) {
+        Stripe& stripe = stripes[std::hash<std::thread::id>()(std::this_thread::get_id()) % kStripes];
+        uint32_t write = stripe.writeCount.load(std::memory_order_relaxed);
+        uint32_t read = stripe.readCount.load(std::memory_order_acquire);
+        if (write - read >= kStripeSize) {
+            return true;
+        }
+        if (!stripe.writeCount.compare_exchange_strong(write, write + 1, std::memory_order_relaxed)) {
+            return false;
+        }
+        Slot& slot = stripe.slots[write % kStripeSize];
+        slot.hash.store(hash, std::memory_order_relaxed);
+        slot.node.store(node, std::memory_order_release);
+        return write + 1 - read >= kDrainThreshold;
+    }
+
+    // 持鎖者：依序把已寫入的事件交給apply處理
+    void drain(const std::function<void(uintptr_t, uint64_t)>& apply) {
+        for (size_t i = 0; i < kStripes; i++) {
+            Stripe& stripe = stripes[i];
+            uint32_t read = stripe.readCount.load(std::memory_order_relaxed);
+            uint32_t write = stripe.writeCount.load(std::memory_order_acquire);
+            for (; read != write; read++) {
+                Slot& slot = stripe.slots[read % kStripeSize];
+                uintptr_t node = slot.node.load(std::memory_order_acquire);
+                if (node == 0) {
+                    // 讀者已取得位置但尚未寫入，下次再處理
+                    break;
+                }
+                uint64_t hash = slot.hash.load(std::memory_order_relaxed);
+                slot.node.store(0, std::memory_order_relaxed);
+                apply(node, hash);
+            }
+            stripe.readCount.store(read, std::memory_order_release);
+        }
+    }
+
+private:
+    struct Slot {
+        std::atomic<uintptr_t> node;
+        std::atomic<uint64_t> hash;
+    };
+
+    struct alignas(64) Stripe {
+        std::atomic<uint32_t> writeCount;
+        std::atomic<uint32_t> readCount;
+        Slot slots[kStripeSize];
+    };
+
+    Stripe stripes[kStripes];
+};
+
+#endif // READ_BUFFER_H
@@ -0,0 +1,472 @@
+#include "ShardedClockCache.h"
+#include <algorithm>
+
+ShardedClockCache::ShardedClockCache(PMmanager* pm, size_t dramSize, size_t nvmSize, size_t numShards,
+                                     bool optimisticReads)
+    : pm(pm), shardBits(0), optimisticReads(optimisticReads), migrationCapacity(0), migrationsInFlight(0),
+      stopMigration(false), migrated(0), migrationsDropped(0), coalescedLoads(0), evictionRequested(false), evictionRunning(false),
+      stopEviction(false), compactionRequested(false), compactionRunning(false), stopCompaction(false) {
+    while ((static_cast<size_t>(1) << shardBits) < numShards) {
+        shardBits++;
+    }
+    size_t count = static_cast<size_t>(1) << shardBits;
+    shards.reserve(count);
+    for (size_t i = 0; i < count; i++) {
+        // 餘數分給前面的shard，確保總容量不變
+        size_t dramShare = dramSize / count + (i < dramSize % count ? 1 : 0);
+        size_t nvmShare = nvmSize / count + (i < nvmSize % count ? 1 : 0);
+        shards.emplace_back(new Shard(pm, dramShare, nvmShare));
+        if (optimisticReads) {
+            // 以平均每個entry 128 bytes估計readIndex的大小
+            shards.back()->cache.enableOptimisticReads(&epoch, (dramShare + nvmShare) / 128);
+        }
+    }
+}
+
+ShardedClockCache::~ShardedClockCache() {
+    if (migrationWorker.joinable()) {
+        {
+            std::lock_guard<std::mutex> lock(migrationMutex);
+            stopMigration = true;
+        }
+        migrationReady.notify_one();
+        migrationWorker.join();
+    }
+    if (evictionWorker.joinable()) {
+        {
+            std::lock_guard<std::mutex> lock(evictionMutex);
+            stopEviction = true;
+        }
+        evictionReady.notify_one();
+        evictionWorker.join();
+    }
+    if (compactionWorker.joinable()) {
+        {
+            std::lock_guard<std::mutex> lock(compactionMutex);
+            stopCompaction = true;
+        }
+        compactionReady.notify_one();
+        compactionWorker.join();
+    }
+}
+
+void ShardedClockCache::enableBackgroundMigration(size_t queueCapacity) {
+    if (migrationWorker.joinable()) return;
+    migrationCapacity = queueCapacity;
+    for (size_t i = 0; i < shards.size(); i++) {
+        std::lock_guard<std::mutex> lock(shards[i]->mutex);
+        shards[i]->cache.setMigrationSink([this, i](std::string_view key) {
+            return enqueueMigration(i, key);
+        });
+    }
+    migrationWorker = std::thread(&ShardedClockCache::runMigrationWorker, this);
+}
+
+// 在持有shard鎖的put()中被呼叫，只取migrationMutex，不會等待其他shard
+bool ShardedClockCache::enqueueMigration(size_t shard, std::string_view key) {
+    {
+        std::lock_guard<std::mutex> lock(migrationMutex);
+        if (migrationQueue.size() >= migrationCapacity) {
+            migrationsDropped.fetch_add(1, std::memory_order_relaxed);
+            return false;
+        }
+        migrationQueue.push_back({shard, std::string(key)});
+    }
+    migrationReady.notify_one();
+    return true;
+}
+
+void ShardedClockCache::runMigrationWorker() {
+    std::unique_lock<std::mutex> lock(migrationMutex);
+    while (true) {
+        migrationReady.wait(lock, [this] { return stopMigration || !migrationQueue.empty(); });
+        if (stopMigration) return;
+        MigrationRequest request = std::move(migrationQueue.front());
+        migrationQueue.pop_front();
+        migrationsInFlight++;
+        lock.unlock();
+
+        // 放開migrationMutex後才取shard鎖，避免和持有shard鎖的enqueueMigration互相等待
+        {
+            Shard& shard = *shards[request.shard];
+            std::lock_guard<std::mutex> shardLock(shard.mutex);
+            if (shard.cache.migrate(request.key)) {
+                migrated.fetch_add(1, std::memory_order_relaxed);
+            }
+        }
+
+        lock.lock();
+        migrationsInFlight--;
+        if (migrationQueue.empty() && migrationsInFlight == 0) {
+            migrationIdle.notify_all();
+        }
+    }
+}
+
+void ShardedClockCache::waitForMigrations() {
+    std::unique_lock<std::mutex> lock(migrationMutex);
+    migrationIdle.wait(lock, [this] { return migrationQueue.empty() && migrationsInFlight == 0; });
+}
+
+size_t ShardedClockCache::recover() {
+    for (auto& shard : shards) {
+        std::lock_guard<std::mutex> lock(shard->mutex);
+        shard->cache.enableWarmRestart();
+    }
+    size_t adopted = 0;
+    NvmCircularLinkedList::recoverRecords(pm, [this, &adopted](NvmRecord* record) {
+        Shard& shard = shardFor(record->keyView());
+        std::lock_guard<std::mutex> lock(shard.mutex);
+        if (shard.cache.adoptNvmRecord(record)) adopted++;
+    });
+    return adopted;
+}
+
+size_t ShardedClockCache::shardOf(std::string_view key) const {
+    if (shardBits == 0) return 0;
+    // 使用hash乘上常數後的高位選shard，原本的hash留給shard內的KeyIndex
+    uint64_t h = StringHash()(key) * 0x9E3779B97F4A7C15ULL;
+    return static_cast<size_t>(h >> (64 - shardBits));
+}
+
+ShardedClockCache::Shard& ShardedClockCache::shardFor(std::string_view key) {
+    return *shards[shardOf(key)];
+}
+
+bool ShardedClockCache::put(std::string_view key, std::string_view value, uint64_t ttlMs) {
+    Shard& shard = shardFor(key);
+    std::lock_guard<std::mutex> lock(shard.mutex);
+    return shard.cache.put(key, value, ttlMs);
+}
+
+bool ShardedClockCache::get(std::string_view key, string* value) {
+    Shard& shard = shardFor(key);
+    bool needDrain = false;
+    if (optimisticReads && shard.cache.getOptimistic(key, value, &needDrain)) {
+        if (needDrain) {
+            // 只在鎖空閒時順便drain，不讓讀者排隊等鎖
+            std::unique_lock<std::mutex> lock(shard.mutex, std::try_to_lock);
+            if (lock.owns_lock()) {
+                shard.cache.drainReadBuffer();
+            }
+        }
+        return true;
+    }
+    std::lock_guard<std::mutex> lock(shard.mutex);
+    return shard.cache.get(key, value);
+}
+
+bool ShardedClockCache::getOrLoad(std::string_view key, string* value, const ClockCache::Loader& loader) {
+    if (get(key, value)) return true;
+    Shard& shard = shardFor(key);
+    std::shared_ptr<PendingLoad> pending;
+    {
+        std::unique_lock<std::mutex> lock(shard.mutex);
+        // 等鎖期間key可能已經被載入或寫入
+        if (shard.cache.get(key, value)) return true;
+        auto it = shard.pendingLoads.find(key);
+        if (it != shard.pendingLoads.end()) {
+            pending = it->second;
+            coalescedLoads.fetch_add(1, std::memory_order_relaxed);
+            pending->ready.wait(lock, [&pending] { return pending->done; });
+            if (pending->error) std::rethrow_exception(pending->error);
+            if (pending->found) value->assign(pending->value);
+            return pending->found;
+        }
+        pending = std::make_shared<PendingLoad>();
+        shard.pendingLoads.emplace(std::string(key), pending);
+    }
+
+    // 不持有shard鎖呼叫loader，同一個shard的其他key不受影響
+    bool found = false;
+    std::exception_ptr error;
+    try {
+        found = loader(key, value);
+    } catch (...) {
+        error = std::current_exception();
+    }
+
+    {
+        std::lock_guard<std::mutex> lock(shard.mutex);
+        if (found) {
+            shard.cache.insertLoaded(key, *value);
+            pending->value = *value;
+        }
+        pending->found = found;
+        pending->error = error;
+        pending->done = true;
+        shard.pendingLoads.erase(shard.pendingLoads.find(key));
+    }
+    pending->ready.notify_all();
+    if (error) std::rethrow_exception(error);
+    return found;
+}
+
+void ShardedClockCache::setLoadTier(LoadTier tier) {
+    for (auto& shard : shards) {
+        std::lock_guard<std::mutex> lock(shard->mutex);
+        shard->cache.setLoadTier(tier);
+    }
+}
+
+CacheHandle ShardedClockCache::lookup(std::string_view key) {
+    Shard& shard = shardFor(key);
+    std::lock_guard<std::mutex> lock(shard.mutex);
+    CacheHandle handle = shard.cache.lookup(key);
+    if (handle) {
+        handle.mutex = &shard.mutex;
+    }
+    return handle;
+}
+
+std::vector<std::vector<size_t>> ShardedClockCache::groupByShard(const std::vector<std::string_view>& keys) const {
+    std::vector<std::vector<size_t>> groups(shards.size());
+    for (size_t i = 0; i < keys.size(); i++) {
+        groups[shardOf(keys[i])].push_back(i);
+    }
+    return groups;
+}
+
+size_t ShardedClockCache::multiGet(const std::vector<std::string_view>& keys, std::vector<string>* values,
+                                   std::vector<bool>* found) {
+    values->resize(keys.size());
+    found->assign(keys.size(), false);
+    std::vector<std::vector<size_t>> groups = groupByShard(keys);
+
+    size_t hits = 0;
+    std::vector<std::string_view> shardKeys;
+    std::vector<string> shardValues;
+    std::vector<bool> shardFound;
+    for (size_t s = 0; s < groups.size(); s++) {
+        if (groups[s].empty()) continue;
+        shardKeys.clear();
+        for (size_t index : groups[s]) {
+            shardKeys.push_back(keys[index]);
+        }
+        {
+            std::lock_guard<std::mutex> lock(shards[s]->mutex);
+            hits += shards[s]->cache.multiGet(shardKeys, &shardValues, &shardFound);
+        }
+        for (size_t j = 0; j < groups[s].size(); j++) {
+            if (!shardFound[j]) continue;
+            (*values)[groups[s][j]] = std::move(shardValues[j]);
+            (*found)[groups[s][j]] = true;
+        }
+    }
+    return hits;
+}
+
+size_t ShardedClockCache::multiPut(const std::vector<std::string_view>& keys, const std::vector<std::string_view>& values) {
+    if (keys.size() != values.size()) return 0;
+    std::vector<std::vector<size_t>> groups = groupByShard(keys);
+    size_t stored = 0;
+
+    std::vector<std::string_view> shardKeys;
+    std::vector<std::string_view> shardValues;
+    for (size_t s = 0; s < groups.size(); s++) {
+        if (groups[s].empty()) continue;
+        shardKeys.clear();
+        shardValues.clear();
+        for (size_t index : groups[s]) {
+            shardKeys.push_back(keys[index]);
+            shardValues.push_back(values[index]);
+        }
+        std::lock_guard<std::mutex> lock(shards[s]->mutex);
+        stored += shards[s]->cache.multiPut(shardKeys, shardValues);
+    }
+    return stored;
+}
+
+void ShardedClockCache::enableDemotion(unsigned int minStatus) {
+    for (auto& shard : shards) {
+        std::lock_guard<std::mutex> lock(shard->mutex);
+        shard->cache.enableDemotion(minStatus);
+    }
+}
+
+void ShardedClockCache::enableAdmissionFilter(size_t expectedEntries, bool rejectToNvm) {
+    size_t perShard = (expectedEntries + shards.size() - 1) / shards.size();
+    for (auto& shard : shards) {
+        std::lock_guard<std::mutex> lock(shard->mutex);
+        shard->cache.enableAdmissionFilter(perShard, rejectToNvm);
+    }
+}
+
+void ShardedClockCache::setClock(std::function<uint64_t()> nowMs) {
+    for (auto& shard : shards) {
+        std::lock_guard<std::mutex> lock(shard->mutex);
+        shard->cache.setClock(nowMs);
+    }
+}
+
+size_t ShardedClockCache::expireEntries(size_t maxEntriesPerShard) {
+    size_t expired = 0;
+    for (auto& shard : shards) {
+        std::lock_guard<std::mutex> lock(shard->mutex);
+        expired += shard->cache.expireEntries(maxEntriesPerShard);
+    }
+    return expired;
+}
+
+void ShardedClockCache::enableAdaptiveSplit(size_t minDram, size_t maxDram, size_t step, size_t ghostEntries) {
+    size_t count = shards.size();
+    for (auto& shard : shards) {
+        std::lock_guard<std::mutex> lock(shard->mutex);
+        shard->cache.enableAdaptiveSplit(minDram / count, maxDram / count, std::max<size_t>(1, step / count),
+                                         (ghostEntries + count - 1) / count);
+    }
+}
+
+void ShardedClockCache::enableBackgroundEviction(double low, double high) {
+    if (evictionWorker.joinable()) return;
+    for (size_t i = 0; i < shards.size(); i++) {
+        std::lock_guard<std::mutex> lock(shards[i]->mutex);
+        shards[i]->cache.setEvictionWatermarks(low, high, [this, i] { requestEviction(i); });
+    }
+    evictionWorker = std::thread(&ShardedClockCache::runEvictionWorker, this);
+}
+
+// 在持有shard鎖的寫入中被呼叫，同一個shard重複通知時只喚醒一次
+void ShardedClockCache::requestEviction(size_t shard) {
+    if (shards[shard]->evictionPending.exchange(true, std::memory_order_acq_rel)) return;
+    {
+        std::lock_guard<std::mutex> lock(evictionMutex);
+        evictionRequested = true;
+    }
+    evictionReady.notify_one();
+}
+
+void ShardedClockCache::runEvictionWorker() {
+    std::unique_lock<std::mutex> lock(evictionMutex);
+    while (true) {
+        evictionReady.wait(lock, [this] { return stopEviction || evictionRequested; });
+        if (stopEviction) return;
+        evictionRequested = false;
+        evictionRunning = true;
+        lock.unlock();
+
+        bool more = true;
+        while (more) {
+            more = false;
+            for (auto& shard : shards) {
+                if (!shard->evictionPending.load(std::memory_order_acquire)) continue;
+                std::lock_guard<std::mutex> shardLock(shard->mutex);
+                shard->evictionPending.store(false, std::memory_order_release);
+                if (!shard->cache.backgroundEvict(kBackgroundEvictionBatch)) {
+                    // 還沒降到low，放開鎖之後再繼續
+                    shard->evictionPending.store(true, std::memory_order_release);
+                    more = true;
+                }
+            }
+        }
+
+        lock.lock();
+        evictionRunning = false;
+        if (!evictionRequested) {
+            evictionIdle.notify_all();
+        }
+    }
+}
+
+void ShardedClockCache::waitForEvictions() {
+    std::unique_lock<std::mutex> lock(evictionMutex);
+    evictionIdle.wait(lock, [this] { return !evictionRequested && !evictionRunning; });
+}
+
+ClockCache::EvictionStats ShardedClockCache::evictionStats() {
+    ClockCache::EvictionStats total = {0, 0, 0, 0, 0};
+    for (auto& shard : shards) {
+        std::lock_guard<std::mutex> lock(shard->mutex);
+        ClockCache::EvictionStats stats = shard->cache.evictionStats();
+        total.foregroundDram += stats.foregroundDram;
+        total.foregroundNvm += stats.foregroundNvm;
+        total.backgroundDram += stats.backgroundDram;
+        total.backgroundNvm += stats.backgroundNvm;
+        total.demoted += stats.demoted;
+    }
+    return total;
+}
+
+size_t ShardedClockCache::nvmShadowBytes() {
+    size_t total = 0;
+    for (auto& shard : shards) {
+        std::lock_guard<std::mutex> lock(shard->mutex);
+        total += shard->cache.nvmShadowBytes();
+    }
+    return total;
+}
+
+void ShardedClockCache::setNvmShadowBudget(size_t bytes) {
+    size_t count = shards.size();
+    for (auto& shard : shards) {
+        std::lock_guard<std::mutex> lock(shard->mutex);
+        // 0表示不限制，有設定預算時每個shard至少分到1 byte
+        shard->cache.setNvmShadowBudget(bytes == 0 ? 0 : std::max<size_t>(1, bytes / count));
+    }
+}
+
+void ShardedClockCache::enableLogStructuredNvm(size_t segmentSize, double compactionRatio) {
+    if (compactionWorker.joinable()) return;
+    for (size_t i = 0; i < shards.size(); i++) {
+        std::lock_guard<std::mutex> lock(shards[i]->mutex);
+        shards[i]->cache.enableLogStructuredNvm(segmentSize, compactionRatio, [this, i] { requestCompaction(i); });
+    }
+    compactionWorker = std::thread(&ShardedClockCache::runCompactionWorker, this);
+}
+
+// 在持有shard鎖的刪除中被呼叫，同一個shard重複通知時只喚醒一次
+void ShardedClockCache::requestCompaction(size_t shard) {
+    if (shards[shard]->compactionPending.exchange(true, std::memory_order_acq_rel)) return;
+    {
+        std::lock_guard<std::mutex> lock(compactionMutex);
+        compactionRequested = true;
+    }
+    compactionReady.notify_one();
+}
+
+void ShardedClockCache::runCompactionWorker() {
+    std::unique_lock<std::mutex> lock(compactionMutex);
+    while (true) {
+        compactionReady.wait(lock, [this] { return stopCompaction || compactionRequested; });
+        if (stopCompaction) return;
+        compactionRequested = false;
+        compactionRunning = true;
+        lock.unlock();
+
+        bool more = true;
+        while (more) {
+            more = false;
+            for (auto& shard : shards) {
+                if (!shard->compactionPending.load(std::memory_order_acquire)) continue;
+                std::lock_guard<std::mutex> shardLock(shard->mutex);
+                shard->compactionPending.store(false, std::memory_order_release);
+                // 沒有可以壓縮的segment(剩下的只是等待回收)時不再重試
+                if (shard->cache.compactNvm(kBackgroundCompactionBatch) > 0 && shard->cache.needsNvmCompaction()) {
+                    // 放開鎖之後再繼續
+                    shard->compactionPending.store(true, std::memory_order_release);
+                    more = true;
+                }
+            }
+        }
+
+        lock.lock();
+        compactionRunning = false;
+        if (!compactionRequested) {
+            compactionIdle.notify_all();
+        }
+    }
+}
+
+void ShardedClockCache::waitForCompactions() {
+    std::unique_lock<std::mutex> lock(compactionMutex);
+    compactionIdle.wait(lock, [this] { return !compactionRequested && !compactionRunning; });
+}
+
+uint64_t ShardedClockCache::nvmCompactionCount() {
+    uint64_t total = 0;
+    for (auto& shard : shards) {
+        std::lock_guard<std::mutex> lock(shard->mutex);
+        total += shard->cache.nvmCompactionCount();
+    }
+    return total;
+}
@@ -0,0 +1,178 @@
+#ifndef SHARDED_CLOCK_CACHE_H
+#define SHARDED_CLOCK_CACHE_H
+
+#include "ClockRWRFCache.h"
+#include <atomic>
+#include <condition_variable>
+#include <deque>
+#include <memory>
+#include <mutex>
+#include <exception>
+#include <thread>
+#include <unordered_map>
+#include <vector>
+
+// 將key依hash分配到N個獨立的ClockCache(各自擁有DRAM/NVM環與鎖)
+// 不同shard上的操作互不阻塞，PMmanager由所有shard共用
+class ShardedClockCache
+{
+private:
+    // getOrLoad()中正在向來源載入的key，其他要求同一個key的執行緒等待這次load的結果
+    struct PendingLoad {
+        std::condition_variable ready;  // 搭配shard鎖使用
+        bool done = false;
+        bool found = false;
+        string value;
+        std::exception_ptr error;  // loader拋出的例外，轉給每個等待者
+    };
+
+    struct alignas(64) Shard {
+        std::mutex mutex;
+        ClockCache cache;
+        std::atomic<bool> evictionPending;  // 使用量超過high水位，等待背景逐出
+        std::atomic<bool> compactionPending;  // NVM segment的live比例過低，等待背景compaction
+        std::unordered_map<std::string, std::shared_ptr<PendingLoad>, StringHash, std::equal_to<>> pendingLoads;
+        Shard(PMmanager *pm, size_t dramSize, size_t nvmSize)
+            : cache(pm, dramSize, nvmSize), evictionPending(false), compactionPending(false) {}
+    };
+
+    PMmanager *pm;
+    std::vector<std::unique_ptr<Shard>> shards;
+    unsigned int shardBits;
+    bool optimisticReads;
+    EpochManager epoch;
+
+    // 背景遷移：put()只把符合條件的key放入有上限的佇列，由migrationWorker在持有shard鎖時執行遷移
+    struct MigrationRequest {
+        size_t shard;
+        std::string key;
+    };
+    std::mutex migrationMutex;
+    std::condition_variable migrationReady;  // 有新請求或要停止
+    std::condition_variable migrationIdle;   // 佇列清空且沒有正在執行的請求
+    std::deque<MigrationRequest> migrationQueue;
+    size_t migrationCapacity;
+    size_t migrationsInFlight;
+    bool stopMigration;
+    std::thread migrationWorker;
+    std::atomic<uint64_t> migrated;
+    std::atomic<uint64_t> migrationsDropped;
+    std::atomic<uint64_t> coalescedLoads;  // 等待其他執行緒load結果而沒有呼叫loader的次數
+
+    bool enqueueMigration(size_t shard, std::string_view key);
+    void runMigrationWorker();
+
+    // 背景逐出：shard寫入後超過high水位時標記evictionPending並喚醒evictionWorker，
+    // evictionWorker每次取得shard鎖只逐出一小批，讓前景的寫入可以穿插進來
+    static constexpr size_t kBackgroundEvictionBatch = 32;
+    std::mutex evictionMutex;
+    std::condition_variable evictionReady;
+    std::condition_variable evictionIdle;
+    bool evictionRequested;
+    bool evictionRunning;
+    bool stopEviction;
+    std::thread evictionWorker;
+
+    void requestEviction(size_t shard);
+    void runEvictionWorker();
+
+    // 背景compaction：和背景逐出相同的通知方式，compactionWorker每次取得shard鎖只壓縮一個segment
+    static constexpr size_t kBackgroundCompactionBatch = 1;
+    std::mutex compactionMutex;
+    std::condition_variable compactionReady;
+    std::condition_variable compactionIdle;
+    bool compactionRequested;
+    bool compactionRunning;
+    bool stopCompaction;
+    std::thread compactionWorker;
+
+    void requestCompaction(size_t shard);
+    void runCompactionWorker();
+
+    Shard& shardFor(std::string_view key);
+    // 回傳每個shard負責的key在原本批次中的位置
+    std::vector<std::vector<size_t>> groupByShard(const std::vector<std::string_view>& keys) const;
+
+public:
+    // numShards會向上取整為2的冪次，dramSize/nvmSize平均分給每個shard
+    // optimisticReads開啟後，已被讀過的key在get()命中時不需要取得shard鎖
+    ShardedClockCache(PMmanager *pm, size_t dramSize, size_t nvmSize, size_t numShards = 16,
+                      bool optimisticReads = false);
+    ~ShardedClockCache();
+    // ttlMs大於0時，ttlMs毫秒後過期；回傳value是否寫入(見ClockCache::put)
+    bool put(std::string_view key, std::string_view value, uint64_t ttlMs = 0);
+    bool get(std::string_view key, string* value);
+    // 回傳的handle在釋放時會自動取得對應的shard鎖
+    CacheHandle lookup(std::string_view key);
+    // 批次操作：先依shard分組，每個shard只取一次鎖
+    size_t multiGet(const std::vector<std::string_view>& keys, std::vector<string>* values,
+                    std::vector<bool>* found);
+    // 回傳寫入的key數量(見ClockCache::multiPut)
+    size_t multiPut(const std::vector<std::string_view>& keys, const std::vector<std::string_view>& values);
+
+    // 讀穿(read-through)：沒有命中時呼叫loader(不持有shard鎖)，同一個key同時只有一個load，
+    // 其他執行緒等待並共用它的結果(包含loader拋出的例外)。載入的value依setLoadTier()放入DRAM或NVM
+    bool getOrLoad(std::string_view key, string* value, const ClockCache::Loader& loader);
+    void setLoadTier(LoadTier tier);
+    uint64_t loadsCoalesced() const { return coalescedLoads.load(std::memory_order_relaxed); }
+
+    // 啟動背景遷移執行緒，NVM到DRAM的遷移與交換不再在put()的呼叫者上執行
+    // 佇列最多queueCapacity個請求，滿了之後新的請求直接丟棄
+    void enableBackgroundMigration(size_t queueCapacity = 1024);
+    // 等到目前佇列中的遷移請求都處理完
+    void waitForMigrations();
+    uint64_t migrationsCompleted() const { return migrated.load(std::memory_order_relaxed); }
+    uint64_t migrationsDroppedCount() const { return migrationsDropped.load(std::memory_order_relaxed); }
+
+    // 每個shard開啟TinyLFU准入過濾(見ClockCache::enableAdmissionFilter)，expectedEntries平均分給每個shard
+    void enableAdmissionFilter(size_t expectedEntries, bool rejectToNvm = true);
+
+    // 每個shard改用nowMs取得目前時間(見ClockCache::setClock)
+    void setClock(std::function<uint64_t()> nowMs);
+    // 每個shard移除最多maxEntriesPerShard個已經過期的節點，回傳移除的總數。
+    // put()本身會順便移除一小批，寫入很少的cache可以定期呼叫這個函式
+    size_t expireEntries(size_t maxEntriesPerShard);
+
+    // 每個shard開啟自適應容量分配(見ClockCache::enableAdaptiveSplit)，參數平均分給每個shard
+    void enableAdaptiveSplit(size_t minDram, size_t maxDram, size_t step, size_t ghostEntries);
+
+    // 每個shard的DRAM逐出節點降級到NVM，見ClockCache::enableDemotion()
+    void enableDemotion(unsigned int minStatus = DramNode::Initial);
+
+    // 啟動背景逐出執行緒：每個shard的使用量超過high(容量比例)時逐出到low以下，
+    // 寫入通常不需要自己逐出，只有背景來不及時才會在前景逐出
+    void enableBackgroundEviction(double low = 0.8, double high = 0.9);
+    // 等到目前所有被標記的shard都逐出完成
+    void waitForEvictions();
+    // 所有shard的逐出次數總和
+    ClockCache::EvictionStats evictionStats();
+    // 所有shard的NVM shadow佔用的DRAM(見ClockCache::nvmShadowBytes)
+    size_t nvmShadowBytes();
+    // shadow的總預算平均分給各shard(見ClockCache::setNvmShadowBudget)
+    void setNvmShadowBudget(size_t bytes);
+
+    // 每個shard的NVM改為log-structured(見ClockCache::enableLogStructuredNvm)，並啟動背景compaction執行緒
+    void enableLogStructuredNvm(size_t segmentSize = NvmCircularLinkedList::kDefaultSegmentSize,
+                                double compactionRatio = 0.5);
+    // 等到目前所有被標記的shard都壓縮完成
+    void waitForCompactions();
+    // 所有shard壓縮過的segment數總和
+    uint64_t nvmCompactionCount();
+
+    // 暖啟動：所有shard開啟warm restart，pool中上次留下的NVM節點依key分配到現在的shard，
+    // shard數量可以和上次不同。必須在第一次寫入之前呼叫，回傳找回的節點數量
+    size_t recover();
+
+    size_t shardCount() const { return shards.size(); }
+    size_t shardOf(std::string_view key) const;
+
+    //This fuction is used for testing
+    FRIEND_TEST(ShardedClockCacheTest, CapacityIsSplitAcrossShards);
+    FRIEND_TEST(ShardedClockCacheTest, BackgroundMigrationPromotesNvmKeys);
+    FRIEND_TEST(ShardedClockCacheTest, BackgroundEvictionKeepsShardsBelowHighWatermark);
+    FRIEND_TEST(ShardedClockCacheTest, RecoverRoutesNodesToNewShardCount);
+    FRIEND_TEST(ShardedClockCacheTest, BackgroundCompactionReclaimsSegments);
+    FRIEND_TEST(ShardedClockCacheTest, GetOrLoadCoalescesConcurrentMisses);
+};
+
+#endif // SHARDED_CLOCK_CACHE_H
@@ -0,0 +1,316 @@
+#include "ShardedClockCache.h"
+#include <gtest/gtest.h>
+#include <atomic>
+#include <stdexcept>
+#include <thread>
+#include <vector>
+
+class ShardedClockCacheTest : public ::testing::Test {
+protected:
+    ShardedClockCache* cache;
+    PMmanager* pm;
+
+    void SetUp() override {
+        pm = new PMmanager("ShardedClockCacheTest");
+        cache = new ShardedClockCache(pm, 64 * 1024, 128 * 1024, 4);
+    }
+
+    void TearDown() override {
+        delete cache;
+        delete pm;
+    }
+};
+
+TEST_F(ShardedClockCacheTest, ShardCountIsPowerOfTwo) {
+    ShardedClockCache odd(pm, 1024, 2048, 5);
+    EXPECT_EQ(odd.shardCount(), 8);
+    ShardedClockCache single(pm, 1024, 2048, 1);
+    EXPECT_EQ(single.shardCount(), 1);
+    EXPECT_EQ(single.shardOf("anyKey"), 0);
+}
+
+TEST_F(ShardedClockCacheTest, CapacityIsSplitAcrossShards) {
+    size_t dramTotal = 0;
+    size_t nvmTotal = 0;
+    for (auto& shard : cache->shards) {
+        dramTotal += shard->cache.dramCapacity;
+        nvmTotal += shard->cache.nvmCapacity;
+    }
+    EXPECT_EQ(dramTotal, 64 * 1024);
+    EXPECT_EQ(nvmTotal, 128 * 1024);
+}
+
+TEST_F(ShardedClockCacheTest, PutAndGetAcrossShards) {
+    for (int i = 0; i < 100; ++i) {
+        cache->put("key" + std::to_string(i), "value" + std::to_string(i));
+    }
+    for (int i = 0; i < 100; ++i) {
+        string value;
+        EXPECT_TRUE(cache->get("key" + std::to_string(i), &value));
+        EXPECT_EQ(value, "value" + std::to_string(i));
+    }
+    string value;
+    EXPECT_FALSE(cache->get("missingKey", &value));
+}
+
+TEST_F(ShardedClockCacheTest, ConcurrentPutAndGet) {
+    const int threadCount = 4;
+    const int keysPerThread = 200;
+    // 所有執行緒的key都要放得進DRAM，否則讀到的結果取決於執行緒交錯的順序
+    // (DRAM節點以arena的size class計算，800個key超過fixture的64KB)
+    ShardedClockCache large(pm, 256 * 1024, 128 * 1024, 4);
+    std::vector<std::thread> threads;
+    std::vector<int> hits(threadCount, 0);
+    for (int t = 0; t < threadCount; ++t) {
+        threads.emplace_back([&large, t, keysPerThread, &hits]() {
+            for (int i = 0; i < keysPerThread; ++i) {
+                string key = "t" + std::to_string(t) + "_" + std::to_string(i);
+                large.put(key, "v" + key);
+            }
+            for (int i = 0; i < keysPerThread; ++i) {
+                string key = "t" + std::to_string(t) + "_" + std::to_string(i);
+                string value;
+                if (large.get(key, &value) && value == "v" + key) {
+                    hits[t]++;
+                }
+            }
+        });
+    }
+    for (auto& thread : threads) {
+        thread.join();
+    }
+    for (int t = 0; t < threadCount; ++t) {
+        EXPECT_EQ(hits[t], keysPerThread);
+    }
+}
+
+TEST_F(ShardedClockCacheTest, ConcurrentOptimisticReadsWithEviction) {
+    // 容量很小，讓寫者不斷逐出與交換讀者正在讀的節點
+    ShardedClockCache optimistic(pm, 4 * 1024, 8 * 1024, 2, true);
+    const int keyCount = 256;
+    std::atomic<bool> stop(false);
+    std::atomic<int> mismatches(0);
+    std::atomic<int> hits(0);
+
+    std::vector<std::thread> readers;
+    for (int t = 0; t < 3; ++t) {
+        readers.emplace_back([&optimistic, &stop, &mismatches, &hits, keyCount, t]() {
+            int i = t;
+            while (!stop.load()) {
+                string key = "key" + std::to_string(i % keyCount);
+                string value;
+                if (optimistic.get(key, &value)) {
+                    hits++;
+                    if (value != "value_" + key) mismatches++;
+                }
+                i += 7;
+            }
+        });
+    }
+    for (int round = 0; round < 20; ++round) {
+        for (int i = 0; i < keyCount; ++i) {
+            string key = "key" + std::to_string(i);
+            optimistic.put(key, "value_" + key);
+        }
+    }
+    stop.store(true);
+    for (auto& reader : readers) {
+        reader.join();
+    }
+    EXPECT_EQ(mismatches.load(), 0);
+    EXPECT_GT(hits.load(), 0);
+}
+
+TEST_F(ShardedClockCacheTest, LookupReturnsPinnedHandle) {
+    cache->put("handleKey", "handleValue");
+    {
+        CacheHandle handle = cache->lookup("handleKey");
+        ASSERT_TRUE(handle);
+        EXPECT_EQ(handle.value(), "handleValue");
+        // handle存在時同一個shard仍然可以讀寫
+        cache->put("handleKey", "newValue");
+        EXPECT_EQ(handle.value(), "handleValue");
+    }
+    string value;
+    EXPECT_TRUE(cache->get("handleKey", &value));
+    EXPECT_EQ(value, "newValue");
+    EXPECT_FALSE(cache->lookup("missingKey"));
+}
+
+TEST_F(ShardedClockCacheTest, MultiGetAndMultiPutAcrossShards) {
+    std::vector<string> keyStorage;
+    std::vector<string> valueStorage;
+    for (int i = 0; i < 64; ++i) {
+        keyStorage.push_back("batchKey" + std::to_string(i));
+        valueStorage.push_back("batchValue" + std::to_string(i));
+    }
+    std::vector<std::string_view> keys(keyStorage.begin(), keyStorage.end());
+    std::vector<std::string_view> values(valueStorage.begin(), valueStorage.end());
+    cache->multiPut(keys, values);
+
+    keys.push_back("missingKey");
+    std::vector<string> retrieved;
+    std::vector<bool> found;
+    EXPECT_EQ(cache->multiGet(keys, &retrieved, &found), 64);
+    for (size_t i = 0; i < 64; ++i) {
+        EXPECT_TRUE(found[i]);
+        EXPECT_EQ(retrieved[i], valueStorage[i]);
+    }
+    EXPECT_FALSE(found[64]);
+}
+
+TEST_F(ShardedClockCacheTest, BackgroundMigrationPromotesNvmKeys) {
+    cache->enableBackgroundMigration(16);
+    std::vector<string> keys;
+    for (int i = 0; i < 8; ++i) {
+        string key = "nvmKey" + std::to_string(i);
+        ClockCache& shardCache = cache->shards[cache->shardOf(key)]->cache;
+        shardCache.nvm_list.insertNode(key, "value0");
+        shardCache.indexNode(shardCache.nvm_list.head->prev, ClockCache::hashKey(key));
+        keys.push_back(key);
+    }
+
+    // 兩次寫入讓NVM節點進入Pre_Migration，遷移交給背景執行緒
+    for (const string& key : keys) {
+        cache->put(key, "value1");
+        cache->put(key, "value2");
+    }
+    cache->waitForMigrations();
+    EXPECT_EQ(cache->migrationsCompleted() + cache->migrationsDroppedCount(), keys.size());
+
+    for (const string& key : keys) {
+        ClockCache& shardCache = cache->shards[cache->shardOf(key)]->cache;
+        string value;
+        EXPECT_TRUE(cache->get(key, &value));
+        EXPECT_EQ(value, "value2");
+        if (shardCache.findDram(key) == nullptr) {
+            // 被丟棄的請求會讓key留在NVM
+            EXPECT_TRUE(shardCache.findNvm(key) != nullptr);
+        }
+    }
+}
+
+TEST_F(ShardedClockCacheTest, BackgroundEvictionKeepsShardsBelowHighWatermark) {
+    cache->enableBackgroundEviction(0.5, 0.8);
+    for (int i = 0; i < 5000; ++i) {
+        cache->put("evictKey" + std::to_string(i), "evictValue" + std::to_string(i));
+    }
+    cache->waitForEvictions();
+
+    for (auto& shard : cache->shards) {
+        std::lock_guard<std::mutex> lock(shard->mutex);
+        EXPECT_LE(shard->cache.dram_list.currentSize, shard->cache.dramCapacity * 8 / 10);
+    }
+    ClockCache::EvictionStats stats = cache->evictionStats();
+    EXPECT_GT(stats.backgroundDram, 0);
+    string value;
+    EXPECT_TRUE(cache->get("evictKey4999", &value));
+    EXPECT_EQ(value, "evictValue4999");
+}
+
+TEST_F(ShardedClockCacheTest, RecoverRoutesNodesToNewShardCount) {
+    // 清空pool中上次留下的節點
+    cache->recover();
+    for (auto& shard : cache->shards) {
+        while (shard->cache.evictNvmNode()) {}
+    }
+    cache->enableDemotion();
+    for (int i = 0; i < 2000; ++i) {
+        cache->put("warmKey" + std::to_string(i), "warmValue" + std::to_string(i));
+    }
+    size_t nvmNodes = 0;
+    for (auto& shard : cache->shards) {
+        for (NvmNode* node = shard->cache.nvm_list.head; node != nullptr; node = node->next) {
+            nvmNodes++;
+            if (node->next == shard->cache.nvm_list.head) break;
+        }
+    }
+    ASSERT_GT(nvmNodes, 0);
+
+    // 重新開啟pool，shard數量改為2(每個shard的容量變大，節點都放得下)
+    delete cache;
+    delete pm;
+    pm = new PMmanager("ShardedClockCacheTest");
+    cache = new ShardedClockCache(pm, 64 * 1024, 128 * 1024, 2);
+    EXPECT_EQ(cache->recover(), nvmNodes);
+
+    size_t hits = 0;
+    string value;
+    for (int i = 0; i < 2000; ++i) {
+        if (cache->get("warmKey" + std::to_string(i), &value)) {
+            EXPECT_EQ(value, "warmValue" + std::to_string(i));
+            hits++;
+        }
+    }
+    EXPECT_EQ(hits, nvmNodes);
+
+    for (auto& shard : cache->shards) {
+        while (shard->cache.evictNvmNode()) {}
+    }
+}
+
+TEST_F(ShardedClockCacheTest, BackgroundCompactionReclaimsSegments) {
+    cache->enableLogStructuredNvm(4096, 0.75);
+    cache->enableDemotion();
+    for (int i = 0; i < 1500; ++i) {
+        cache->put("logKey" + std::to_string(i), "logValue" + std::to_string(i));
+    }
+    // 放不下原本record的新value會寫成新的record，NVM中大部分的舊record變成Retired，
+    // 背景執行緒把live比例低的segment壓縮掉
+    for (int i = 0; i < 1500; ++i) {
+        if (i % 3 == 0) continue;
+        cache->put("logKey" + std::to_string(i), "updatedLogValue" + std::to_string(i));
+    }
+    cache->waitForCompactions();
+    EXPECT_GT(cache->nvmCompactionCount(), 0);
+    for (auto& shard : cache->shards) {
+        std::lock_guard<std::mutex> lock(shard->mutex);
+        EXPECT_TRUE(shard->cache.nvm_list.compactionCandidate(0.75) == nullptr || !shard->cache.needsNvmCompaction());
+    }
+
+    string value;
+    for (int i = 0; i < 1500; ++i) {
+        if (cache->get("logKey" + std::to_string(i), &value)) {
+            EXPECT_EQ(value, (i % 3 == 0 ? "logValue" : "updatedLogValue") + std::to_string(i));
+        }
+    }
+}
+
+TEST_F(ShardedClockCacheTest, GetOrLoadCoalescesConcurrentMisses) {
+    const int threadCount = 8;
+    std::atomic<int> loads(0);
+    // loader等到其他執行緒都在等待這次load才回傳，確認它們沒有各自呼叫loader
+    ClockCache::Loader loader = [this, &loads](std::string_view key, string* value) {
+        loads++;
+        while (cache->loadsCoalesced() < threadCount - 1) {
+            std::this_thread::yield();
+        }
+        value->assign("loaded_" + std::string(key));
+        return true;
+    };
+    cache->setLoadTier(LoadTier::Nvm);
+
+    std::vector<std::thread> threads;
+    std::vector<string> values(threadCount);
+    for (int t = 0; t < threadCount; ++t) {
+        threads.emplace_back([this, t, &loader, &values] {
+            EXPECT_TRUE(cache->getOrLoad("hotKey", &values[t], loader));
+        });
+    }
+    for (auto& thread : threads) {
+        thread.join();
+    }
+    EXPECT_EQ(loads.load(), 1);
+    for (const string& value : values) {
+        EXPECT_EQ(value, "loaded_hotKey");
+    }
+    ClockCache& shardCache = cache->shards[cache->shardOf("hotKey")]->cache;
+    EXPECT_TRUE(shardCache.findNvm("hotKey") != nullptr);
+
+    // loader拋出的例外傳給這次load的呼叫者，失敗的load不會留在cache中
+    EXPECT_THROW(cache->getOrLoad("brokenKey", &values[0],
+                                  [](std::string_view, string*) -> bool { throw std::runtime_error("backend down"); }),
+                 std::runtime_error);
+    string value;
+    EXPECT_FALSE(cache->get("brokenKey", &value));
+}
@@ -0,0 +1,163 @@
+#ifndef TIMING_WHEEL_H
+#define TIMING_WHEEL_H
+
+#include <cstddef>
+#include <cstdint>
+#include <functional>
+
+// 一個有TTL的entry在timing wheel中的位置，node是ClockCache的節點(含tier標記，見KeyIndex)
+struct TimerEntry {
+    TimerEntry* prev;
+    TimerEntry* next;
+    uint64_t expiresAt;  // 毫秒
+    uintptr_t node;
+    uint8_t level;
+    uint8_t slot;
+};
+
+// 階層式timing wheel：4層、每層64個slot，第0層一個slot是一個tick，每往上一層涵蓋的時間乘以64。
+// entry放在到期tick與目前tick最高的不同位數那一層，上層的slot輪到時把entry往下層重新分配，
+// 每個entry最多被搬移4次，排程、取消與到期都是O(1)(攤還)。超過最上層範圍的entry先放在最上層，輪到時再重新排程。
+// 只取出已經過去的tick中的entry，所以entry最多晚一個tick被取出；讀取時是否過期由呼叫者用expiresAt精確判斷。
+// entry由wheel配置與釋放。不是thread-safe，由ClockCache的呼叫者串行化。
+class TimingWheel {
+public:
+    static const unsigned int kLevels = 4;
+    static const unsigned int kSlotBits = 6;
+    static const size_t kSlots = static_cast<size_t>(1) << kSlotBits;
+
+    TimingWheel(uint64_t tickMs, uint64_t nowMs)
+        : tickMs(tickMs), currentTick(nowMs / tickMs), cascadedTick(UINT64_MAX), count(0) {
+        for (unsigned int level = 0; level < kLevels; level++) {
+            occupied[level] = 0;
+            for (size_t slot = 0; slot < kSlots; slot++) {
+                slots[level][slot] = nullptr;
+            }
+        }
+    }
+
+    TimingWheel(const TimingWheel&) = delete;
+    TimingWheel& operator=(const TimingWheel&) = delete;
+
+    ~TimingWheel() {
+        for (unsigned int level = 0; level < kLevels; level++) {
+            for (size_t slot = 0; slot < kSlots; slot++) {
+                TimerEntry* entry = slots[level][slot];
+                while (entry != nullptr) {
+                    TimerEntry* next = entry->next;
+                    delete entry;
+                    entry = next;
+                }
+            }
+        }
+    }
+
+    // 登記node在expiresAt過期，回傳的entry在cancel()或到期之前一直有效
+    TimerEntry* schedule(uint64_t expiresAt, uintptr_t node) {
+        TimerEntry* entry = new TimerEntry{nullptr, nullptr, expiresAt, node, 0, 0};
+        place(entry, expiresAt / tickMs);
+        count++;
+        return entry;
+    }
+
+    void cancel(TimerEntry* entry) {
+        unlink(entry);
+        count--;
+        delete entry;
+    }
+
+    // 依序取出到期tick已經過去(早於nowMs所在的tick)的entry交給expire，最多處理maxEntries個，回傳到期的數量。
+    // expire回傳true後entry被釋放；回傳false表示entry現在不能處理(例如節點被pin住)，它會被排到下一個tick再試
+    size_t advance(uint64_t nowMs, size_t maxEntries, const std::function<bool(TimerEntry*)>& expire) {
+        uint64_t nowTick = nowMs / tickMs;
+        size_t expired = 0;
+        size_t visited = 0;  // 被退回的entry也算在這一批的工作量內
+        while (visited < maxEntries && currentTick < nowTick) {
+            if (count == 0) {
+                currentTick = nowTick;
+                break;
+            }
+            size_t slot = currentTick & (kSlots - 1);
+            if (slot == 0 && cascadedTick != currentTick) {
+                cascade();
+                cascadedTick = currentTick;
+            }
+            if (TimerEntry* entry = slots[0][slot]) {
+                unlink(entry);
+                visited++;
+                if (expire(entry)) {
+                    count--;
+                    expired++;
+                    delete entry;
+                } else {
+                    place(entry, currentTick + 1);
+                }
+                continue;
+            }
+            // 這個slot已經清空：跳到第0層下一個有entry的slot，最遠到下一次cascade的邊界
+            uint64_t pending = occupied[0] >> slot;
+            currentTick += pending == 0 ? kSlots - slot : __builtin_ctzll(pending);
+            if (currentTick > nowTick) currentTick = nowTick;
+        }
+        return expired;
+    }
+
+    size_t size() const { return count; }
+
+private:
+    uint64_t tickMs;
+    uint64_t currentTick;   // 之前的tick都已經處理完
+    uint64_t cascadedTick;  // 最後一次cascade的tick，同一個tick只cascade一次
+    size_t count;
+    TimerEntry* slots[kLevels][kSlots];
+    uint64_t occupied[kLevels];  // 每層有entry的slot
+
+    void place(TimerEntry* entry, uint64_t tick) {
+        if (tick < currentTick) tick = currentTick;
+        uint64_t diff = tick ^ currentTick;
+        unsigned int level = 0;
+        while (level + 1 < kLevels && (diff >> ((level + 1) * kSlotBits)) != 0) level++;
+        size_t slot = (tick >> (level * kSlotBits)) & (kSlots - 1);
+        if (tick - currentTick >= (static_cast<uint64_t>(1) << (kLevels * kSlotBits))) {
+            // 超過最上層的範圍：放在最上層最晚輪到的slot
+            slot = ((currentTick >> (level * kSlotBits)) - 1) & (kSlots - 1);
+        }
+        TimerEntry*& head = slots[level][slot];
+        entry->prev = nullptr;
+        entry->next = head;
+        if (head != nullptr) head->prev = entry;
+        head = entry;
+        entry->level = static_cast<uint8_t>(level);
+        entry->slot = static_cast<uint8_t>(slot);
+        occupied[level] |= static_cast<uint64_t>(1) << slot;
+    }
+
+    void unlink(TimerEntry* entry) {
+        if (entry->prev != nullptr) {
+            entry->prev->next = entry->next;
+        } else {
+            slots[entry->level][entry->slot] = entry->next;
+            if (entry->next == nullptr) occupied[entry->level] &= ~(static_cast<uint64_t>(1) << entry->slot);
+        }
+        if (entry->next != nullptr) entry->next->prev = entry->prev;
+    }
+
+    // currentTick到了第0層的邊界：從最上層開始，把輪到的slot中的entry重新分配到下層
+    void cascade() {
+        for (unsigned int level = kLevels - 1; level > 0; level--) {
+            uint64_t lowerBits = (static_cast<uint64_t>(1) << (level * kSlotBits)) - 1;
+            if ((currentTick & lowerBits) != 0) continue;
+            size_t slot = (currentTick >> (level * kSlotBits)) & (kSlots - 1);
+            TimerEntry* entry = slots[level][slot];
+            slots[level][slot] = nullptr;
+            occupied[level] &= ~(static_cast<uint64_t>(1) << slot);
+            while (entry != nullptr) {
+                TimerEntry* next = entry->next;
+                place(entry, entry->expiresAt / tickMs);
+                entry = next;
+            }
+        }
+    }
+};
+
+#endif // TIMING_WHEEL_H
@@ -7,12 +7,25 @@ using std::string;
 
   
 
-PMmanager::PMmanager(std::string db_name): used(0) {
+static std::atomic<uint64_t> nextManagerId(1);
+
+PMmanager::PMmanager(std::string db_name, Durability durability, Backend backend)
+    : mapped_len(0), is_pmem(0), used(0), backend(backend), durability(durability), enqueuedSyncs(0),
+      committedSyncs(0), drainWaiters(0), stopCommitter(false), groupCommits(0), id(nextManagerId.fetch_add(1)),
+      batchPublishes(0) {
     static const size_t pmem_len = 1L * 1024 * 1024 * 1024;
     static const std::string path = "/home/oslab/Desktop/pmem/";
     
     std::string pool_name = path + db_name;
     //std::cout<<"Enter PMmanager :"<<"path name = "<<pool_name<<std::endl;
+    if (backend == Backend::Mapped) {
+        openMapped(pool_name, pmem_len);
+        free = pmem_len;
+        if (durability == Durability::Async) {
+            committer = std::thread(&PMmanager::runCommitter, this);
+        }
+        return;
+    }
     pool = pmemobj_open(pool_name.c_str(), LAYOUT_NAME);
     if (pool == NULL) {
         perror("pmemobj_open error");
@@ -25,13 +38,34 @@ PMmanager::PMmanager(std::string db_name): used(0) {
         } 
     }
     free = pmem_len;
+    // PMEMobjpool指向pool映射的起點
+    is_pmem = pmem_is_pmem(pool, 1);
+    if (durability == Durability::Async) {
+        committer = std::thread(&PMmanager::runCommitter, this);
+    }
 }
 
 PMmanager::~PMmanager() {
+    if (committer.joinable()) {
+        {
+            std::lock_guard<std::mutex> lock(dirtyMutex);
+            stopCommitter = true;
+        }
+        dirtyReady.notify_one();
+        committer.join();
+    }
+    releaseCached();
+    if (backend == Backend::Mapped) {
+        // 不是PM時把Volatile模式留下的dirty page寫回
+        if (!is_pmem) pmem_msync(base, mapped_len);
+        pmem_unmap(base, mapped_len);
+        return;
+    }
     pmemobj_close(pool);     //有問題要解決
 }
 
 void *PMmanager::Allocate(size_t bytes) {
+    if (backend == Backend::Mapped) return mappedAllocate(bytes, 0, NULL, NULL);
     PMEMoid oid;
     int ret = pmemobj_alloc(pool, &oid, bytes, 0, NULL, NULL);
     //std::cout<<"Allocate:"<<bytes<<"byte"<<std::endl;
@@ -43,24 +77,344 @@ void *PMmanager::Allocate(size_t bytes) {
     }
 }
 
+void *PMmanager::Allocate(size_t bytes, uint64_t type, pmemobj_constr constructor, void* arg) {
+    if (backend == Backend::Mapped) return mappedAllocate(bytes, type, constructor, arg);
+    if (bytes > kMaxCachedSize) {
+        PMEMoid oid;
+        int ret = pmemobj_alloc(pool, &oid, bytes, type, constructor, arg);
+        return ret == 0 ? pmemobj_direct(oid) : NULL;
+    }
+    size_t classSize = (bytes + kCacheClassSize - 1) / kCacheClassSize * kCacheClassSize;
+    std::vector<void*>& objects = freeList(classSize, type);
+    if (objects.empty() && !refill(objects, classSize, type)) return NULL;
+    void* ptr = objects.back();
+    objects.pop_back();
+    if (constructor != NULL && constructor(pool, ptr, arg) != 0) {
+        objects.push_back(ptr);
+        return NULL;
+    }
+    return ptr;
+}
+
 void PMmanager::Free(void* ptr) {
     if (ptr == NULL) {
         return; // 如果 ptr 為 NULL，則無需執行任何操作
     }
+    if (backend == Backend::Mapped) {
+        mappedFree(ptr);
+        return;
+    }
 
     PMEMoid oid = pmemobj_oid(ptr);
-    if (!OID_IS_NULL(oid)) {
-        pmemobj_free(&oid);
-    } else {
+    if (OID_IS_NULL(oid)) {
         perror("pmemobj_free error");
+        return;
+    }
+    uint64_t type = pmemobj_type_num(oid);
+    size_t usable = pmemobj_alloc_usable_size(oid);
+    if (type == 0 || usable < kCacheClassSize || usable > 2 * kMaxCachedSize) {
+        pmemobj_free(&oid);
+        return;
+    }
+    // 放回快取前清掉header，crash後不會被當成有效的物件
+    size_t headerBytes = usable < kCachedHeaderBytes ? usable : kCachedHeaderBytes;
+    memset(ptr, 0, headerBytes);
+    Sync(ptr, headerBytes);
+    size_t classSize = usable / kCacheClassSize * kCacheClassSize;
+    std::vector<void*>& objects = freeList(classSize < kMaxCachedSize ? classSize : kMaxCachedSize, type);
+    objects.push_back(ptr);
+    if (objects.size() > kMaxCachedPerList) {
+        release(objects, kRefillBatch);
+    }
+}
+
+PMmanager::ThreadCache& PMmanager::localCache() {
+    thread_local uint64_t cachedId = 0;
+    thread_local ThreadCache* cached = NULL;
+    if (cachedId == id) return *cached;
+    std::lock_guard<std::mutex> lock(cachesMutex);
+    std::unique_ptr<ThreadCache>& cache = caches[std::this_thread::get_id()];
+    if (!cache) cache.reset(new ThreadCache());
+    cachedId = id;
+    cached = cache.get();
+    return *cached;
+}
+
+std::vector<void*>& PMmanager::freeList(size_t classSize, uint64_t type) {
+    ThreadCache& cache = localCache();
+    for (FreeList& list : cache.lists) {
+        if (list.classSize == classSize && list.type == type) return list.objects;
+    }
+    cache.lists.push_back({type, classSize, {}});
+    return cache.lists.back().objects;
+}
+
+// 保留一批物件、清掉header並persist後，一次publish
+bool PMmanager::refill(std::vector<void*>& objects, size_t classSize, uint64_t type) {
+    struct pobj_action actions[kRefillBatch];
+    size_t reserved = 0;
+    for (; reserved < kRefillBatch; reserved++) {
+        PMEMoid oid = pmemobj_xreserve(pool, &actions[reserved], classSize, type, 0);
+        if (OID_IS_NULL(oid)) break;
+        void* ptr = pmemobj_direct(oid);
+        memset(ptr, 0, kCachedHeaderBytes);
+        pmemobj_flush(pool, ptr, kCachedHeaderBytes);
+        objects.push_back(ptr);
+    }
+    if (reserved == 0) return false;
+    pmemobj_drain(pool);
+    if (pmemobj_publish(pool, actions, reserved) != 0) {
+        pmemobj_cancel(pool, actions, reserved);
+        objects.resize(objects.size() - reserved);
+        return false;
+    }
+    batchPublishes.fetch_add(1, std::memory_order_relaxed);
+    return true;
+}
+
+// 釋放objects最後count個物件，同樣只publish一次
+void PMmanager::release(std::vector<void*>& objects, size_t count) {
+    struct pobj_action actions[kRefillBatch];
+    while (count > 0 && !objects.empty()) {
+        size_t batch = 0;
+        for (; batch < kRefillBatch && batch < count && !objects.empty(); batch++) {
+            pmemobj_defer_free(pool, pmemobj_oid(objects.back()), &actions[batch]);
+            objects.pop_back();
+        }
+        pmemobj_publish(pool, actions, batch);
+        batchPublishes.fetch_add(1, std::memory_order_relaxed);
+        count -= batch;
+    }
+}
+
+void PMmanager::releaseCached() {
+    std::lock_guard<std::mutex> lock(cachesMutex);
+    for (auto& entry : caches) {
+        for (FreeList& list : entry.second->lists) {
+            release(list.objects, list.objects.size());
+        }
     }
 }
 
 //flush to PM
+//Obj backend由libpmemobj依是否為真正的PM選擇cache flush或msync，Mapped backend依is_pmem自己選擇
 void PMmanager::Sync(void *start, size_t len) {
-    if (is_pmem) {
-        pmem_persist(start, len);
+    if (durability == Durability::Strict) {
+        flushRange(start, len);
+        drainRanges();
+    } else if (durability == Durability::Async) {
+        bool full;
+        {
+            std::lock_guard<std::mutex> lock(dirtyMutex);
+            dirty.emplace_back(start, len);
+            enqueuedSyncs++;
+            full = dirty.size() >= kGroupCommitBatch;
+        }
+        if (full) dirtyReady.notify_one();
+    }
+}
+
+void PMmanager::Drain() {
+    if (durability != Durability::Async) return;
+    std::unique_lock<std::mutex> lock(dirtyMutex);
+    uint64_t target = enqueuedSyncs;
+    drainWaiters++;
+    dirtyReady.notify_one();
+    committed.wait(lock, [this, target] { return committedSyncs >= target; });
+    drainWaiters--;
+}
+
+size_t PMmanager::PendingSyncs() {
+    std::lock_guard<std::mutex> lock(dirtyMutex);
+    return enqueuedSyncs - committedSyncs;
+}
+
+// 每一批只在最後drain一次；停止前會把剩下的範圍也persist
+void PMmanager::runCommitter() {
+    std::vector<std::pair<void*, size_t>> batch;
+    std::unique_lock<std::mutex> lock(dirtyMutex);
+    while (true) {
+        dirtyReady.wait_for(lock, kGroupCommitInterval, [this] {
+            return stopCommitter || dirty.size() >= kGroupCommitBatch || (drainWaiters > 0 && !dirty.empty());
+        });
+        if (dirty.empty()) {
+            if (stopCommitter) return;
+            continue;
+        }
+        batch.swap(dirty);
+        lock.unlock();
+        for (auto& range : batch) {
+            flushRange(range.first, range.second);
+        }
+        drainRanges();
+        groupCommits.fetch_add(1, std::memory_order_relaxed);
+        lock.lock();
+        committedSyncs += batch.size();
+        batch.clear();
+        committed.notify_all();
+    }
+}
+
+void PMmanager::flushRange(void* start, size_t len) {
+    if (backend == Backend::Obj) {
+        pmemobj_flush(pool, start, len);
+    } else if (is_pmem) {
+        pmem_flush(start, len);
     } else {
         pmem_msync(start, len);
     }
 }
+
+void PMmanager::drainRanges() {
+    if (backend == Backend::Obj) {
+        pmemobj_drain(pool);
+    } else if (is_pmem) {
+        pmem_drain();
+    }
+}
+
+void PMmanager::Copy(void* dest, const void* src, size_t len) {
+    if (!is_pmem || len < kNonTemporalThreshold) {
+        memcpy(dest, src, len);
+    } else if (backend == Backend::Mapped) {
+        pmem_memcpy_nodrain(dest, src, len);
+    } else {
+        pmemobj_memcpy(pool, dest, src, len, PMEMOBJ_F_MEM_NONTEMPORAL | PMEMOBJ_F_MEM_NODRAIN);
+    }
+}
+
+void *PMmanager::Root(size_t size) {
+    if (backend == Backend::Mapped) {
+        std::lock_guard<std::mutex> lock(heapMutex);
+        if (header->rootOffset == 0) {
+            // 和一般物件一樣從heapTop切出，之後的走訪會跳過它
+            size_t rootSize = blockSize(size);
+            MappedBlock* block = reinterpret_cast<MappedBlock*>(base + header->heapTop);
+            memset(block, 0, rootSize);
+            block->size = rootSize;
+            block->state = (kMappedRootType << 1) | 1;
+            Sync(block, rootSize);
+            header->rootOffset = header->heapTop;
+            header->heapTop += rootSize;
+            Sync(header, sizeof(MappedHeader));
+        }
+        return base + header->rootOffset + sizeof(MappedBlock);
+    }
+    return pmemobj_direct(pmemobj_root(pool, size));
+}
+
+void *PMmanager::First() {
+    if (backend == Backend::Mapped) return mappedFrom(kMappedHeapStart);
+    releaseCached();
+    return pmemobj_direct(pmemobj_first(pool));
+}
+
+void *PMmanager::Next(void* ptr) {
+    if (backend == Backend::Mapped) {
+        uint64_t offset = reinterpret_cast<char*>(blockOf(ptr)) - base;
+        return mappedFrom(offset + blockOf(ptr)->size);
+    }
+    return pmemobj_direct(pmemobj_next(pmemobj_oid(ptr)));
+}
+
+uint64_t PMmanager::TypeOf(void* ptr) {
+    if (backend == Backend::Mapped) return blockOf(ptr)->state >> 1;
+    return pmemobj_type_num(pmemobj_oid(ptr));
+}
+
+size_t PMmanager::UsableSize(void* ptr) {
+    if (backend == Backend::Mapped) return blockOf(ptr)->size - sizeof(MappedBlock);
+    return pmemobj_alloc_usable_size(pmemobj_oid(ptr));
+}
+
+// 檔案不是上次留下的heap時重新初始化；否則走訪block重建free list，
+// 遇到不合理的block(header還沒寫完就crash)時把heapTop退回那裡
+void PMmanager::openMapped(const std::string& path, size_t len) {
+    base = static_cast<char*>(pmem_map_file(path.c_str(), len, PMEM_FILE_CREATE, 0666, &mapped_len, &is_pmem));
+    if (base == NULL) {
+        perror("pmem_map_file error");
+        exit(1);
+    }
+    header = reinterpret_cast<MappedHeader*>(base);
+    if (header->magic != kMappedMagic || header->size != mapped_len || header->heapTop < kMappedHeapStart ||
+        header->heapTop > mapped_len) {
+        header->magic = kMappedMagic;
+        header->size = mapped_len;
+        header->heapTop = kMappedHeapStart;
+        header->rootOffset = 0;
+        Sync(header, sizeof(MappedHeader));
+        return;
+    }
+    uint64_t offset = kMappedHeapStart;
+    while (offset < header->heapTop) {
+        MappedBlock* block = reinterpret_cast<MappedBlock*>(base + offset);
+        if (block->size < sizeof(MappedBlock) || block->size != blockSize(block->size - sizeof(MappedBlock)) ||
+            block->size > header->heapTop - offset) {
+            header->heapTop = offset;
+            Sync(&header->heapTop, sizeof(header->heapTop));
+            break;
+        }
+        if (block->state == 0) freeBlocks[block->size].push_back(offset);
+        offset += block->size;
+    }
+}
+
+// 小的block以64 bytes為單位，大的以4KB為單位，同樣大小的block可以互相重用
+size_t PMmanager::blockSize(size_t bytes) {
+    size_t size = bytes + sizeof(MappedBlock);
+    if (size <= kMaxCachedSize) return (size + kCacheClassSize - 1) / kCacheClassSize * kCacheClassSize;
+    return (size + kMappedHeapStart - 1) / kMappedHeapStart * kMappedHeapStart;
+}
+
+PMmanager::MappedBlock* PMmanager::blockOf(void* ptr) const {
+    return reinterpret_cast<MappedBlock*>(static_cast<char*>(ptr) - sizeof(MappedBlock));
+}
+
+// constructor寫完之後才寫入state，crash時物件不會只寫了一半就被當成已配置
+void* PMmanager::mappedAllocate(size_t bytes, uint64_t type, pmemobj_constr constructor, void* arg) {
+    size_t size = blockSize(bytes);
+    MappedBlock* block;
+    {
+        std::lock_guard<std::mutex> lock(heapMutex);
+        std::vector<uint64_t>& blocks = freeBlocks[size];
+        if (!blocks.empty()) {
+            block = reinterpret_cast<MappedBlock*>(base + blocks.back());
+            blocks.pop_back();
+        } else {
+            if (header->heapTop + size > mapped_len) return NULL;
+            block = reinterpret_cast<MappedBlock*>(base + header->heapTop);
+            block->size = size;
+            block->state = 0;
+            Sync(block, sizeof(MappedBlock));
+            header->heapTop += size;
+            Sync(&header->heapTop, sizeof(header->heapTop));
+        }
+    }
+    void* ptr = block + 1;
+    if (constructor != NULL && constructor(NULL, ptr, arg) != 0) {
+        std::lock_guard<std::mutex> lock(heapMutex);
+        freeBlocks[size].push_back(reinterpret_cast<char*>(block) - base);
+        return NULL;
+    }
+    block->state = (type << 1) | 1;
+    Sync(&block->state, sizeof(block->state));
+    return ptr;
+}
+
+void PMmanager::mappedFree(void* ptr) {
+    MappedBlock* block = blockOf(ptr);
+    block->state = 0;
+    Sync(&block->state, sizeof(block->state));
+    std::lock_guard<std::mutex> lock(heapMutex);
+    freeBlocks[block->size].push_back(reinterpret_cast<char*>(block) - base);
+}
+
+// offset開始的第一個已配置的物件(不含root)
+void* PMmanager::mappedFrom(uint64_t offset) {
+    while (offset < header->heapTop) {
+        MappedBlock* block = reinterpret_cast<MappedBlock*>(base + offset);
+        if (block->state != 0 && offset != header->rootOffset) return block + 1;
+        offset += block->size;
+    }
+    return NULL;
+}
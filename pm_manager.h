@@ -14,14 +14,70 @@
 #include <string>
 #include <fstream>
 #include <iostream>
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <mutex>
+#include <memory>
+#include <thread>
+#include <unordered_map>
+#include <utility>
+#include <vector>
 
+// Sync()的行為，決定寫入NVM的資料何時變成durable
+enum class Durability {
+    Volatile,  // 不flush，只有正常關閉pool時才會寫回，crash後最近的寫入可能遺失
+    Async,     // Sync()只記錄範圍，背景執行緒成批flush後只drain一次(group commit)
+    Strict     // Sync()返回前就已經persist，put()返回時資料已經durable
+};
+
+// pool的實作方式
+enum class Backend {
+    Obj,     // libpmemobj的pool
+    Mapped   // pmem_map_file直接映射檔案，由PMmanager自己管理配置；不是PM時以msync寫回
+};
+
+// 有type的Allocate/Free(Obj backend)經過每個執行緒各自的配置快取(依size class與type分開)，
+// 常見情況下只是從快取取出/放回，不需要pmemobj_alloc/pmemobj_free的redo log與fence。
+// 快取空了時以pmemobj_xreserve一次保留一批物件，再用一次pmemobj_publish整批配置。
+// 快取中的物件在pool中是已配置的，開頭kCachedHeaderBytes bytes清為0，使用者必須把全為0的
+// header當成無效物件(例如NvmRecord的state不是Live)，crash後recovery會把它們釋放。
+// 快取只由擁有它的執行緒存取，同一個PMmanager可以被多個shard同時使用
+// Sync()在Async模式下只取dirtyMutex，同樣可以被多個shard同時呼叫
 class PMmanager {
 public:
-    PMmanager(std::string pool_name);
+    PMmanager(std::string pool_name, Durability durability = Durability::Strict, Backend backend = Backend::Obj);
     ~PMmanager();
     void Sync(void *start, size_t len);
+    // 把資料複製到NVM：在PM上不小於kNonTemporalThreshold的資料以non-temporal store寫入，
+    // 不經過CPU cache也不drain，之後仍要Sync()
+    void Copy(void* dest, const void* src, size_t len);
+    Backend GetBackend() const { return backend; }
+    // 等到這次呼叫之前Sync()的範圍都已經persist(Async模式)
+    void Drain();
+    Durability GetDurability() const { return durability; }
+    bool IsPmem() const { return is_pmem != 0; }
+    // Async模式：還沒flush的範圍數與已完成的group commit次數
+    size_t PendingSyncs();
+    uint64_t GroupCommits() const { return groupCommits.load(std::memory_order_relaxed); }
     void* Allocate(size_t bytes);
+    // 以type標記配置。不超過kMaxCachedSize的物件從執行緒的快取取出，constructor寫入後自行persist，
+    // crash時寫到一半的物件要由使用者檢查出來(例如checksum)；更大的物件直接pmemobj_alloc，
+    // constructor在配置對外可見前執行
+    void* Allocate(size_t bytes, uint64_t type, pmemobj_constr constructor, void* arg);
+    // 有type的物件放回目前執行緒的快取，快取太多時整批釋放
     void Free(void* ptr);
+    // 已經做過的整批publish次數(配置與釋放)
+    uint64_t BatchPublishes() const { return batchPublishes.load(std::memory_order_relaxed); }
+
+    // pool的root物件，第一次呼叫時配置並清為0
+    void* Root(size_t size);
+    // 依序走訪pool中所有已配置的物件，沒有下一個時回傳NULL
+    // First()會先把所有執行緒快取中的物件還給pool，不能和Allocate/Free同時執行(recovery時使用)
+    void* First();
+    void* Next(void* ptr);
+    uint64_t TypeOf(void* ptr);
+    size_t UsableSize(void* ptr);
 
 private:
     size_t mapped_len;
@@ -29,6 +85,77 @@ private:
     size_t used;
     size_t free;
     PMEMobjpool *pool = NULL;
+    Backend backend;
+
+    static constexpr size_t kNonTemporalThreshold = 256;
+    void flushRange(void* start, size_t len);
+    void drainRanges();
+
+    // Mapped backend：檔案開頭是MappedHeader，之後是連續的block(MappedBlock + 物件)，
+    // heapTop之後從未配置過。釋放的block依大小放在DRAM的freeBlocks中重用，開啟時走訪block重建
+    struct MappedHeader {
+        uint64_t magic;
+        uint64_t size;
+        uint64_t heapTop;     // 第一個從未配置過的offset
+        uint64_t rootOffset;  // root物件所在block的offset，0表示還沒有
+    };
+    struct MappedBlock {
+        uint64_t size;   // 含header的block大小
+        uint64_t state;  // type << 1 | 1 表示已配置，0表示free；一次8 bytes寫入
+    };
+    static constexpr uint64_t kMappedMagic = 0x504d4d4150504544ULL;
+    static constexpr uint64_t kMappedRootType = UINT64_MAX >> 1;
+    static constexpr size_t kMappedHeapStart = 4096;
+    char* base = NULL;
+    MappedHeader* header = NULL;
+    std::mutex heapMutex;
+    std::unordered_map<size_t, std::vector<uint64_t>> freeBlocks;
+    void openMapped(const std::string& path, size_t len);
+    static size_t blockSize(size_t bytes);
+    MappedBlock* blockOf(void* ptr) const;
+    void* mappedAllocate(size_t bytes, uint64_t type, pmemobj_constr constructor, void* arg);
+    void mappedFree(void* ptr);
+    void* mappedFrom(uint64_t offset);
+
+    // Async模式的group commit：累積kGroupCommitBatch個範圍或每隔kGroupCommitInterval做一次
+    static constexpr size_t kGroupCommitBatch = 64;
+    static constexpr std::chrono::microseconds kGroupCommitInterval{500};
+    Durability durability;
+    std::mutex dirtyMutex;
+    std::condition_variable dirtyReady;
+    std::condition_variable committed;
+    std::vector<std::pair<void*, size_t>> dirty;
+    uint64_t enqueuedSyncs;   // 已記錄的範圍總數
+    uint64_t committedSyncs;  // 已persist的範圍總數
+    size_t drainWaiters;      // 正在Drain()等待的執行緒數，有人等待時不等批次湊滿
+    bool stopCommitter;
+    std::thread committer;
+    std::atomic<uint64_t> groupCommits;
+    void runCommitter();
+
+    // 每個執行緒的配置快取
+    static constexpr size_t kCacheClassSize = 64;     // size class的級距
+    static constexpr size_t kMaxCachedSize = 4096;    // 更大的物件不經過快取
+    static constexpr size_t kRefillBatch = 32;        // 一次保留/釋放的物件數
+    static constexpr size_t kMaxCachedPerList = 128;  // 每個list超過時釋放kRefillBatch個
+    static constexpr size_t kCachedHeaderBytes = 64;  // 快取中的物件清為0的開頭長度
+    struct FreeList {
+        uint64_t type;
+        size_t classSize;
+        std::vector<void*> objects;
+    };
+    struct ThreadCache {
+        std::vector<FreeList> lists;  // 通常只有少數幾種type與大小，直接線性搜尋
+    };
+    uint64_t id;  // 區分不同的PMmanager，thread_local只記住最近使用的一個
+    std::mutex cachesMutex;
+    std::unordered_map<std::thread::id, std::unique_ptr<ThreadCache>> caches;
+    std::atomic<uint64_t> batchPublishes;
+    ThreadCache& localCache();
+    std::vector<void*>& freeList(size_t classSize, uint64_t type);
+    bool refill(std::vector<void*>& objects, size_t classSize, uint64_t type);
+    void release(std::vector<void*>& objects, size_t count);
+    void releaseCached();
     bool create_directory(const std::string& path) {
         size_t pos = 0;
         std::string dir;